@@ -123,6 +123,29 @@ int main() {
           break;
         }
       }
+    } else if (strncmp(buffer, "stats", strlen("stats")) == 0) {
+      const char *reasons[HAL_DROP_REASONS] = {"bad checksum", "no route",
+                                               "arp miss", "ttl expired",
+                                               "bad rip", "oversize",
+                                               "no buffer"};
+      for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+        HAL_Stats stats;
+        int res = HAL_GetStats(i, &stats);
+        if (res != 0) {
+          printf("Stats failed: %d\n", res);
+          break;
+        }
+        printf("%d: rx %llu packets %llu bytes, tx %llu packets %llu bytes\n",
+               i, (unsigned long long)stats.rx_packets,
+               (unsigned long long)stats.rx_bytes,
+               (unsigned long long)stats.tx_packets,
+               (unsigned long long)stats.tx_bytes);
+        printf("   dropped:");
+        for (int j = 0; j < HAL_DROP_REASONS; j++) {
+          printf(" %s %llu", reasons[j], (unsigned long long)stats.drops[j]);
+        }
+        printf("\n");
+      }
     } else if (strncmp(buffer, "quit", strlen("quit")) == 0) {
       free(buffer);
       break;
@@ -135,6 +158,7 @@ int main() {
       printf("\tcap: capture one packet\n");
       printf("\tout index: send random packet to interface\n");
       printf("\tloop: read packets until interrupted\n");
+      printf("\tstats: show packet counters of every interface\n");
       printf("\tquit: exit shell\n");
     }
     free(buffer);
@@ -9,6 +9,8 @@
 #include <arpa/inet.h>
 #elif defined ROUTER_BACKEND_STDIO
 #include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_XDP
+#include <arpa/inet.h>
 #elif defined ROUTER_BACKEND_XILINX
 typedef uint32_t in_addr_t;
 #endif
@@ -18,8 +20,101 @@ typedef uint32_t in_addr_t;
 #define HAL_OUT
 
 #define N_IFACE_ON_BOARD 4
+// 转发线程数量的上限，见 HAL_SetWorkerCount
+#define HAL_MAX_WORKERS 8
 typedef uint8_t macaddr_t[6];
 
+/**
+ * @brief 批量收发时一个 IPv4 报文的描述符
+ */
+typedef struct {
+  // 报文缓冲区，由调用者分配
+  uint8_t *buffer;
+  // 缓冲区大小，接收时由调用者填写
+  size_t size;
+  // 报文长度，接收时由 HAL 填写，大于 size 时说明报文被截断；发送时由调用者填写
+  size_t length;
+  // 接收时为报文来源的接口号
+  int if_index;
+  // 接收时为 IPv4 报文下层的源 MAC 地址
+  macaddr_t src_mac;
+  // IPv4 报文下层的目的 MAC 地址，接收时由 HAL 填写，发送时由调用者填写
+  macaddr_t dst_mac;
+} HAL_PacketDesc;
+
+// HAL_Frame 中 data 之前保证可以由 HAL 写入的字节数
+#define HAL_FRAME_HEADROOM 32
+
+/**
+ * @brief 由 HAL 管理的一个 IPv4 报文缓冲区，用于不复制报文的转发
+ */
+typedef struct {
+  // IPv4 报文的起始地址，之前的 HAL_FRAME_HEADROOM 字节留给 HAL 写入链路层头部
+  uint8_t *data;
+  // IPv4 报文长度，修改报文时不能超过接收时的长度
+  size_t length;
+  // 报文来源的接口号
+  int if_index;
+  // IPv4 报文下层的源 MAC 地址
+  macaddr_t src_mac;
+  // IPv4 报文下层的目的 MAC 地址，发送前由调用者改为下一跳的 MAC 地址
+  macaddr_t dst_mac;
+  // HAL 内部使用
+  uint64_t handle;
+} HAL_Frame;
+
+/**
+ * @brief 到一个邻居的二层转发信息，由调用者分配，挂接到 HAL 后由 HAL 就地更新
+ */
+typedef struct HAL_Adjacency {
+  // 出接口号，挂接前由调用者填写
+  int if_index;
+  // 邻居的 IPv4 地址，挂接前由调用者填写
+  in_addr_t ip;
+  // 以太网头部：邻居的 MAC 地址、接口的 MAC 地址、类型 IPv4
+  uint8_t header[14];
+  // 非零表示已经知道邻居的 MAC 地址，header 可以直接使用；HAL 先写 header
+  // 再置位，其他线程应当以 acquire 语义读取，如 __atomic_load_n
+  int valid;
+  // HAL 内部使用：header 每次更新前后各加一，发送时读到奇数或前后不一致就重读
+  unsigned int seq;
+  // HAL 内部使用
+  struct HAL_Adjacency *next;
+} HAL_Adjacency;
+
+/**
+ * @brief 报文被丢弃的原因，用于 HAL_CountDrop 和 HAL_Stats
+ */
+typedef enum {
+  // IPv4 头部校验和错误
+  HAL_DROP_BAD_CHECKSUM = 0,
+  // 没有到目的地址的路由
+  HAL_DROP_NO_ROUTE,
+  // 下一跳的 MAC 地址未知，等待 ARP 应答时被丢弃
+  HAL_DROP_ARP_MISS,
+  // TTL 耗尽
+  HAL_DROP_TTL_EXPIRED,
+  // 格式错误的 RIP 报文
+  HAL_DROP_BAD_RIP,
+  // 报文超过接收缓冲区大小
+  HAL_DROP_OVERSIZE,
+  // 接收缓冲区或发送队列已满
+  HAL_DROP_NO_BUFFER,
+  HAL_DROP_REASONS
+} HAL_DropReason;
+
+/**
+ * @brief 一个接口上的报文计数，字节数为 IPv4 报文长度之和
+ */
+typedef struct {
+  uint64_t rx_packets;
+  uint64_t rx_bytes;
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+  // 以 HAL_DropReason 为下标
+  uint64_t drops[HAL_DROP_REASONS];
+} HAL_Stats;
+
 enum HAL_ERROR_NUMBER {
   HAL_ERR_INVALID_PARAMETER = -1000,
   HAL_ERR_IP_NOT_EXIST,
@@ -45,6 +140,45 @@ extern "C" {
  */
 int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]);
 
+/**
+ * @brief 设置转发线程的数量，唯一可以在 HAL_Init 之前调用的函数，默认为 1
+ *
+ * 每个转发线程在每个接口上有自己的接收和发送队列，各自调用
+ * HAL_ReceiveFrames 等接口而不需要加锁。同一个接口上的报文按五元组的哈希分给
+ * 各个线程，同一条流的报文总是由同一个线程收到，只要这个线程按顺序转发，流内的
+ * 顺序就不会被打乱。只有部分后端支持多个转发线程
+ *
+ * @param n IN，转发线程数量，[1, HAL_MAX_WORKERS]
+ * @return int 0 表示成功，HAL_ERR_NOT_SUPPORTED 表示后端不支持，其他非 0 为失败
+ */
+int HAL_SetWorkerCount(HAL_IN int n);
+
+/**
+ * @brief 让当前线程作为第 worker 个转发线程，在 HAL_Init 之后、线程第一次收发
+ * 之前调用
+ *
+ * 此后当前线程收发报文都使用这个转发线程的队列，同一时刻一个转发线程只能被一个
+ * 线程使用。没有调用过的线程视为第 0 个转发线程。HAL_ReceiveFrames 收到的报文
+ * 只能在同一个线程中发送或者释放
+ *
+ * @param worker IN，转发线程编号，[0, n-1]，n 为 HAL_SetWorkerCount 设置的数量
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_BindWorker(HAL_IN int worker);
+
+/**
+ * @brief 唤醒第 worker 个转发线程，可以在任何线程中调用
+ *
+ * 这个转发线程正在等待或者下一次等待的 HAL_ReceiveFrames、HAL_ReceiveIPPackets
+ * 等接口会立即返回，没有收到报文时返回 0。用于其他线程交给转发线程的工作，这样
+ * 转发线程可以用 -1 无限等待，而不必定期醒来查看；多次唤醒在转发线程醒来之前
+ * 只算一次，只有第一次需要系统调用
+ *
+ * @param worker IN，转发线程编号，含义同 HAL_BindWorker
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_WakeWorker(HAL_IN int worker);
+
 /**
  * @brief 获取从启动到当前时刻的毫秒数
  *
@@ -90,11 +224,28 @@ int HAL_GetInterfaceMacAddress(HAL_IN int if_index, HAL_OUT macaddr_t o_mac);
  * @param timeout IN，设置接收超时时间（毫秒），-1 表示无限等待
  * @param if_index OUT，实际接收到的报文来源的接口号，不能为空指针
  * @return int >0 表示实际接收的报文长度，=0 表示超时返回，<0 表示发生错误
+ *
+ * 等价于 n 为 1 的 HAL_ReceiveIPPackets
  */
 int HAL_ReceiveIPPacket(HAL_IN int if_index_mask, HAL_OUT uint8_t *buffer, HAL_IN size_t length,
                         HAL_OUT macaddr_t src_mac, HAL_OUT macaddr_t dst_mac, HAL_IN int64_t timeout,
                         HAL_OUT int *if_index);
 
+/**
+ * @brief 批量接收 IPv4 报文，一次调用从所有选中的接口中取走当前可以读取的报文
+ *
+ * 在收到至少一个报文或超时之前会一直等待，之后不再等待，返回时已经收到的报文；
+ * 每个报文的内容写入对应描述符的 buffer 中，其余字段由 HAL 填写
+ *
+ * @param if_index_mask IN，接口索引号的 bitset，含义同 HAL_ReceiveIPPacket
+ * @param descs IN/OUT，长度为 n 的描述符数组，调用者需填写 buffer 和 size
+ * @param n IN，最多接收的报文个数
+ * @param timeout IN，设置接收超时时间（毫秒），-1 表示无限等待
+ * @return int >0 表示实际接收的报文个数，=0 表示超时返回，<0 表示发生错误
+ */
+int HAL_ReceiveIPPackets(HAL_IN int if_index_mask, HAL_OUT HAL_PacketDesc *descs, HAL_IN int n,
+                         HAL_IN int64_t timeout);
+
 /**
  * @brief 发送一个 IP 报文，它的源 MAC 地址就是对应接口的 MAC 地址
  *
@@ -103,10 +254,148 @@ int HAL_ReceiveIPPacket(HAL_IN int if_index_mask, HAL_OUT uint8_t *buffer, HAL_I
  * @param length IN，待发送报文的长度
  * @param dst_mac IN，IPv4 报文下层的目的 MAC 地址
  * @return int 0 表示成功，非 0 为失败
+ *
+ * 报文会立即发出，不会留在 HAL_SendIPPackets 的发送队列中
  */
 int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t length,
                      HAL_IN macaddr_t dst_mac);
 
+/**
+ * @brief 批量发送 IP 报文，它们的源 MAC 地址就是对应接口的 MAC 地址
+ *
+ * 报文被复制进接口的发送队列，函数返回后缓冲区即可重用；队列满或者调用
+ * HAL_FlushIPPackets 时才一次性交给系统发送，所以发完一批报文后需要调用
+ * HAL_FlushIPPackets
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param descs IN，长度为 n 的描述符数组，调用者需填写 buffer、length 和 dst_mac
+ * @param n IN，报文个数
+ * @return int >=0 表示放入发送队列的报文个数，<0 表示发生错误
+ */
+int HAL_SendIPPackets(HAL_IN int if_index, HAL_IN HAL_PacketDesc *descs, HAL_IN int n);
+
+/**
+ * @brief 把接口发送队列中的报文交给系统发送
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]，-1 表示所有接口
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_FlushIPPackets(HAL_IN int if_index);
+
+/**
+ * @brief 批量接收 IPv4 报文，报文留在 HAL 的缓冲区中，不复制给调用者
+ *
+ * 等待方式同 HAL_ReceiveIPPackets。收到的每个 HAL_Frame 都归调用者所有，
+ * 调用者可以直接修改 data 中的报文，用完后必须交给 HAL_SendFrames 或者
+ * HAL_ReleaseFrames，否则 HAL 的缓冲区会被耗尽
+ *
+ * @param if_index_mask IN，接口索引号的 bitset，含义同 HAL_ReceiveIPPacket
+ * @param frames OUT，长度为 n 的数组
+ * @param n IN，最多接收的报文个数
+ * @param timeout IN，设置接收超时时间（毫秒），-1 表示无限等待
+ * @return int >0 表示实际接收的报文个数，=0 表示超时返回，<0 表示发生错误
+ */
+int HAL_ReceiveFrames(HAL_IN int if_index_mask, HAL_OUT HAL_Frame *frames, HAL_IN int n,
+                      HAL_IN int64_t timeout);
+
+/**
+ * @brief 从接口发送 HAL_ReceiveFrames 收到的报文，链路层头部在原缓冲区中就地写入
+ *
+ * 源 MAC 地址为对应接口的 MAC 地址，目的 MAC 地址为 frame 的 dst_mac。报文同
+ * HAL_SendIPPackets 一样进入发送队列，需要调用 HAL_FlushIPPackets；无论成功
+ * 与否，调用后这些 HAL_Frame 都归还给 HAL，不能再使用
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param frames IN，长度为 n 的数组
+ * @param n IN，报文个数
+ * @return int >=0 表示放入发送队列的报文个数，<0 表示发生错误
+ */
+int HAL_SendFrames(HAL_IN int if_index, HAL_IN HAL_Frame *frames, HAL_IN int n);
+
+/**
+ * @brief 把 HAL_ReceiveFrames 收到的报文发给接口上的一个邻居，由 HAL 查询 ARP 表
+ *
+ * 与 HAL_SendFrames 相同，但目的 MAC 地址为 ip 对应的 MAC 地址，frame 的
+ * dst_mac 被忽略。还不知道 ip 的 MAC 地址时，HAL 发送 ARP 请求，并把报文复制
+ * 一份暂存，学习到 MAC 地址时一起发出；每个邻居和所有邻居暂存的报文数量都有
+ * 上限，超出上限或者邻居一直没有回应的报文会被丢弃并计数
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param ip IN，邻居的 IPv4 地址，可以是组播地址
+ * @param frames IN，长度为 n 的数组
+ * @param n IN，报文个数
+ * @return int >=0 表示放入发送队列或者暂存的报文个数，<0 表示发生错误
+ */
+int HAL_SendFramesToNeighbor(HAL_IN int if_index, HAL_IN in_addr_t ip, HAL_IN HAL_Frame *frames,
+                             HAL_IN int n);
+
+/**
+ * @brief 把不再需要的 HAL_Frame 归还给 HAL
+ *
+ * @param frames IN，长度为 n 的数组
+ * @param n IN，报文个数
+ */
+void HAL_ReleaseFrames(HAL_IN HAL_Frame *frames, HAL_IN int n);
+
+/**
+ * @brief 把一个 HAL_Adjacency 交给 HAL 维护
+ *
+ * HAL 填写 header 中接口的 MAC 地址，此后每当学习到这个邻居的 MAC 地址，或者
+ * 它过期被遗忘时，就地更新 header 和 valid；还没有学习到的邻居由 HAL 自动发送
+ * ARP 报文查询，这一工作由第 0 个转发线程在接收报文时完成。直连网段这类不对应
+ * 单个邻居的路由不需要挂接。可以在其他线程中调用，在 HAL_DetachAdjacency 之前
+ * adj 不能被释放
+ *
+ * @param adj IN/OUT，调用者需填写 if_index 和 ip
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_AttachAdjacency(HAL_OUT HAL_Adjacency *adj);
+
+/**
+ * @brief 不再维护 HAL_AttachAdjacency 挂接的 HAL_Adjacency，返回后 valid 为 0
+ *
+ * 可以在其他线程中调用
+ *
+ * @param adj IN，已经挂接的 HAL_Adjacency
+ */
+void HAL_DetachAdjacency(HAL_OUT HAL_Adjacency *adj);
+
+/**
+ * @brief 经由一个邻居发送 HAL_ReceiveFrames 收到的报文
+ *
+ * 与 HAL_SendFrames 相同，但不查询任何表，直接把 adj 的 header 写到报文之前，
+ * 从 adj 的出接口发出，frame 的 dst_mac 被忽略。adj 的 valid 必须非零
+ *
+ * @param adj IN，已经挂接并且 valid 非零的 HAL_Adjacency
+ * @param frames IN，长度为 n 的数组
+ * @param n IN，报文个数
+ * @return int >=0 表示放入发送队列的报文个数，<0 表示发生错误
+ */
+int HAL_SendFramesVia(HAL_IN HAL_Adjacency *adj, HAL_IN HAL_Frame *frames, HAL_IN int n);
+
+/**
+ * @brief 读取一个接口上的报文计数
+ *
+ * 每个线程在自己的计数槽中计数，读取时把所有线程的计数加起来，因此可以在任意
+ * 线程中调用而不影响转发。各项计数不是在同一时刻读取的，彼此之间可能略有出入
+ *
+ * @param if_index IN，接口号，[0, N_IFACE_ON_BOARD-1]
+ * @param stats OUT，接口上的计数
+ * @return int 0 表示成功，HAL_ERR_NOT_SUPPORTED 表示后端不支持，其他非 0 为失败
+ */
+int HAL_GetStats(HAL_IN int if_index, HAL_OUT HAL_Stats *stats);
+
+/**
+ * @brief 记录一个在 HAL 之外被丢弃的报文，计入 HAL_GetStats 的 drops
+ *
+ * 由转发逻辑在丢弃报文时调用，开销与一次内存写入相当。HAL 自己丢弃的报文，
+ * 如等待 ARP 时被丢弃的报文，由 HAL 计数
+ *
+ * @param if_index IN，报文来源的接口号
+ * @param reason IN，丢弃原因，HAL_DropReason 之一
+ */
+void HAL_CountDrop(HAL_IN int if_index, HAL_IN int reason);
+
 #ifdef __cplusplus
 }
 #endif
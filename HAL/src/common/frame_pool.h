@@ -0,0 +1,105 @@
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+// don't include this file in your own code.
+// Fixed set of packet buffers behind HAL_Frame for backends that cannot lend
+// out their receive buffers. Every buffer has HAL_FRAME_HEADROOM bytes in
+// front of the packet, so the link layer header can be written in place.
+#include "router_hal.h"
+#include <stdint.h>
+#include <string.h>
+
+const int FRAME_POOL_SIZE = 256;
+const size_t FRAME_BUFFER_SIZE = 2048;
+// largest packet a buffer holds
+const size_t FRAME_POOL_MTU = FRAME_BUFFER_SIZE - HAL_FRAME_HEADROOM;
+// packets received per call of HAL_ReceiveIPPackets
+const int FRAME_POOL_BURST = 64;
+
+struct FramePool {
+  uint8_t buffers[FRAME_POOL_SIZE][FRAME_BUFFER_SIZE];
+  // buffers not held by the caller
+  int free_list[FRAME_POOL_SIZE];
+  int free_count;
+  bool inited;
+};
+
+static void FramePoolInit(FramePool *pool) {
+  for (int i = 0; i < FRAME_POOL_SIZE; i++) {
+    pool->free_list[i] = FRAME_POOL_SIZE - 1 - i;
+  }
+  pool->free_count = FRAME_POOL_SIZE;
+  pool->inited = true;
+}
+
+// returns a free buffer, or -1 if every buffer is held
+static int FramePoolAlloc(FramePool *pool) {
+  if (!pool->inited) {
+    FramePoolInit(pool);
+  }
+  if (pool->free_count == 0) {
+    return -1;
+  }
+  return pool->free_list[--pool->free_count];
+}
+
+// where the packet starts in a buffer
+static uint8_t *FramePoolData(FramePool *pool, int index) {
+  return pool->buffers[index] + HAL_FRAME_HEADROOM;
+}
+
+static void FramePoolRelease(FramePool *pool, uint64_t index) {
+  if (index < (uint64_t)FRAME_POOL_SIZE) {
+    pool->free_list[pool->free_count++] = (int)index;
+  }
+}
+
+// receives like HAL_ReceiveIPPackets, each packet is copied once into a pool
+// buffer that the caller holds until it is released
+static int FramePoolReceive(FramePool *pool, int if_index_mask,
+                            HAL_Frame *frames, int n, int64_t timeout) {
+  if (frames == NULL || n <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (!pool->inited) {
+    FramePoolInit(pool);
+  }
+  int count = n < FRAME_POOL_BURST ? n : FRAME_POOL_BURST;
+  if (count > pool->free_count) {
+    count = pool->free_count;
+  }
+  if (count == 0) {
+    // the caller holds every buffer
+    return HAL_ERR_UNKNOWN;
+  }
+
+  HAL_PacketDesc descs[FRAME_POOL_BURST];
+  int indices[FRAME_POOL_BURST];
+  for (int i = 0; i < count; i++) {
+    indices[i] = FramePoolAlloc(pool);
+    descs[i].buffer = FramePoolData(pool, indices[i]);
+    descs[i].size = FRAME_POOL_MTU;
+  }
+  int res = HAL_ReceiveIPPackets(if_index_mask, descs, count, timeout);
+  int received = 0;
+  for (int i = 0; i < count; i++) {
+    // truncated packets are dropped, as they cannot be forwarded
+    if (i >= res || descs[i].length > descs[i].size) {
+      if (i < res) {
+        HAL_CountDrop(descs[i].if_index, HAL_DROP_OVERSIZE);
+      }
+      FramePoolRelease(pool, indices[i]);
+      continue;
+    }
+    HAL_Frame &frame = frames[received++];
+    frame.data = descs[i].buffer;
+    frame.length = descs[i].length;
+    frame.if_index = descs[i].if_index;
+    memcpy(frame.src_mac, descs[i].src_mac, sizeof(macaddr_t));
+    memcpy(frame.dst_mac, descs[i].dst_mac, sizeof(macaddr_t));
+    frame.handle = indices[i];
+  }
+  return res < 0 ? res : received;
+}
+
+#endif
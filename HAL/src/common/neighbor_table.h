@@ -0,0 +1,538 @@
+#ifndef __NEIGHBOR_TABLE_H__
+#define __NEIGHBOR_TABLE_H__
+
+// don't include this file in your own code.
+// ARP cache shared by the backends: a fixed open addressing table, so that a
+// lookup on the forwarding path touches a few adjacent slots and never
+// allocates. An entry lives within NEIGHBOR_PROBE_LIMIT slots of its hash,
+// when those are taken the least useful one is evicted, which keeps the
+// table bounded no matter how many addresses are asked for.
+//
+// The table also keeps the HAL_Adjacency objects attached by the caller and
+// patches their Ethernet header whenever the neighbor is learned, and holds
+// the first packets sent to a neighbor until its MAC address is known. Held
+// packets go back to the worker that held them, so that they are sent in
+// order with the rest of their flow.
+//
+// Everything above is done under the table lock. Known neighbors are also
+// published to a seqlocked copy of the slots, which NeighborLookup reads
+// without it, so that sending to a resolved neighbor never takes the lock.
+#include "router_hal.h"
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+
+const uint32_t NEIGHBOR_TABLE_BITS = 10;
+const uint32_t NEIGHBOR_TABLE_SIZE = 1 << NEIGHBOR_TABLE_BITS;
+const uint32_t NEIGHBOR_PROBE_LIMIT = 8;
+// a learned address is asked for again after this many milliseconds, and
+// forgotten if nobody answers for as long once more
+const uint64_t NEIGHBOR_REACHABLE_TIME = 5 * 60 * 1000;
+// at most one ARP request per address in this many milliseconds
+const uint64_t NEIGHBOR_RETRY_TIME = 1000;
+// packets waiting for an ARP reply, per neighbor and for all of them. They
+// are copied out of the receive buffers, so that a neighbor that never
+// answers cannot pin those; larger packets are not held.
+const int NEIGHBOR_HOLD_LIMIT = 4;
+const int NEIGHBOR_HOLD_SIZE = 64;
+const size_t NEIGHBOR_HOLD_MTU = 1536;
+// ARP requests NeighborMaintain asks for at a time
+const int NEIGHBOR_MAINTAIN_BURST = 32;
+
+enum NeighborState {
+  NEIGHBOR_FREE = 0,
+  // asked for, no answer yet
+  NEIGHBOR_INCOMPLETE,
+  NEIGHBOR_REACHABLE,
+  // addresses of our own interfaces, never evicted
+  NEIGHBOR_PERMANENT,
+};
+
+struct NeighborEntry {
+  in_addr_t ip;
+  uint8_t if_index;
+  uint8_t state;
+  macaddr_t mac;
+  // packets held while INCOMPLETE, the first one is only valid if any
+  uint8_t held_count;
+  int16_t held_first;
+  // when the MAC address was last learned, and when it was last asked for
+  uint64_t confirmed;
+  uint64_t requested;
+};
+
+// what NeighborLookup sees of the entry in the same slot, rewritten by
+// NeighborPublish after every change to it
+struct NeighborPublished {
+  // odd while being written
+  unsigned int seq;
+  in_addr_t ip;
+  uint8_t if_index;
+  uint8_t state;
+  macaddr_t mac;
+  uint64_t confirmed;
+};
+
+struct NeighborHeld {
+  uint8_t packet[NEIGHBOR_HOLD_MTU];
+  size_t length;
+  // next packet of the same neighbor or worker, or next free one
+  int16_t next;
+  // the worker that held it, and where it goes once released
+  uint8_t worker;
+  uint8_t if_index;
+  macaddr_t mac;
+};
+
+// sends a held packet once its next hop is known
+typedef void (*NeighborSender)(int if_index, const uint8_t *packet,
+                               size_t length, const macaddr_t mac);
+
+// an ARP request to send once the table is unlocked
+struct NeighborRequest {
+  int if_index;
+  in_addr_t ip;
+};
+
+struct NeighborTable {
+  NeighborEntry slots[NEIGHBOR_TABLE_SIZE];
+  NeighborPublished published[NEIGHBOR_TABLE_SIZE];
+  NeighborHeld held[NEIGHBOR_HOLD_SIZE];
+  // first free held packet, -1 if all are in use
+  int16_t held_free;
+  bool held_inited;
+  // held packets whose neighbor has been learned, per worker in the order
+  // they were held; first and last are only valid if the count is not 0,
+  // which is also read without the lock
+  int16_t released_first[HAL_MAX_WORKERS];
+  int16_t released_last[HAL_MAX_WORKERS];
+  int released_count[HAL_MAX_WORKERS];
+  // packets that could not be held or whose neighbor never answered, per
+  // outgoing interface
+  uint64_t hold_dropped[N_IFACE_ON_BOARD];
+  // attached adjacencies, linked through their next field
+  HAL_Adjacency *adjacencies;
+  // when the adjacencies were last checked, also read without the lock by
+  // NeighborMaintainDue
+  uint64_t maintained;
+  // adjacencies are attached from other threads, so the caller holds this
+  // around every function below but NeighborLookup, NeighborMaintainDue and
+  // NeighborSendReleased
+  std::mutex lock;
+};
+
+static uint32_t NeighborHash(in_addr_t ip, int if_index) {
+  uint32_t key = ip ^ ((uint32_t)if_index * 0x9E3779B9u);
+  return (key * 0x85EBCA6Bu) >> (32 - NEIGHBOR_TABLE_BITS);
+}
+
+static NeighborEntry *NeighborSlot(NeighborTable *table, uint32_t hash,
+                                   uint32_t i) {
+  return &table->slots[(hash + i) & (NEIGHBOR_TABLE_SIZE - 1)];
+}
+
+// multicast addresses map onto MAC addresses without asking (RFC 1112)
+static bool NeighborMulticast(in_addr_t ip, macaddr_t o_mac) {
+  if ((ip & 0xe0) != 0xe0) {
+    return false;
+  }
+  uint8_t mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f),
+                    (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+  memcpy(o_mac, mac, sizeof(macaddr_t));
+  return true;
+}
+
+// copies the fields NeighborLookup needs of an entry to its published slot,
+// as a seqlock in the same way as NeighborUpdateAdjacency
+static void NeighborPublish(NeighborTable *table, const NeighborEntry *entry) {
+  NeighborPublished *pub = &table->published[entry - table->slots];
+  // writers hold the table lock, so there is only ever one
+  unsigned int seq = __atomic_load_n(&pub->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&pub->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&pub->ip, entry->ip, __ATOMIC_RELAXED);
+  __atomic_store_n(&pub->if_index, entry->if_index, __ATOMIC_RELAXED);
+  __atomic_store_n(&pub->state, entry->state, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < sizeof(macaddr_t); i++) {
+    __atomic_store_n(&pub->mac[i], entry->mac[i], __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&pub->confirmed, entry->confirmed, __ATOMIC_RELAXED);
+  __atomic_store_n(&pub->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// drops the packets an entry holds
+static void NeighborDropHeld(NeighborTable *table, NeighborEntry *entry) {
+  for (; entry->held_count > 0; entry->held_count--) {
+    int16_t index = entry->held_first;
+    entry->held_first = table->held[index].next;
+    table->held[index].next = table->held_free;
+    table->held_free = index;
+    table->hold_dropped[entry->if_index]++;
+  }
+}
+
+// frees the entry if it has run out of time, returns whether it is in use
+static bool NeighborAlive(NeighborTable *table, NeighborEntry *entry,
+                          uint64_t now) {
+  bool expired = false;
+  if (entry->state == NEIGHBOR_INCOMPLETE) {
+    expired = entry->requested + NEIGHBOR_RETRY_TIME * 3 < now;
+  } else if (entry->state == NEIGHBOR_REACHABLE) {
+    expired = entry->confirmed + NEIGHBOR_REACHABLE_TIME * 2 < now;
+  }
+  if (expired) {
+    NeighborDropHeld(table, entry);
+    entry->state = NEIGHBOR_FREE;
+    NeighborPublish(table, entry);
+  }
+  return entry->state != NEIGHBOR_FREE;
+}
+
+static NeighborEntry *NeighborFind(NeighborTable *table, in_addr_t ip,
+                                   int if_index, uint64_t now) {
+  uint32_t hash = NeighborHash(ip, if_index);
+  // freed slots do not end the search, the window is short anyway
+  for (uint32_t i = 0; i < NEIGHBOR_PROBE_LIMIT; i++) {
+    NeighborEntry *entry = NeighborSlot(table, hash, i);
+    if (entry->ip == ip && entry->if_index == if_index &&
+        NeighborAlive(table, entry, now)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static uint64_t NeighborLastSeen(const NeighborEntry *entry) {
+  return entry->state == NEIGHBOR_INCOMPLETE ? entry->requested
+                                             : entry->confirmed;
+}
+
+// returns a slot for a new entry, or NULL if every candidate is more useful
+// than what would replace it
+static NeighborEntry *NeighborAllocate(NeighborTable *table, in_addr_t ip,
+                                       int if_index, uint64_t now,
+                                       bool reachable) {
+  uint32_t hash = NeighborHash(ip, if_index);
+  NeighborEntry *victim = NULL;
+  for (uint32_t i = 0; i < NEIGHBOR_PROBE_LIMIT; i++) {
+    NeighborEntry *entry = NeighborSlot(table, hash, i);
+    if (!NeighborAlive(table, entry, now)) {
+      victim = entry;
+      break;
+    }
+    // unanswered requests go first, then the longest unconfirmed address;
+    // a request never pushes out an address that is known
+    if (entry->state == NEIGHBOR_PERMANENT ||
+        (entry->state == NEIGHBOR_REACHABLE && !reachable)) {
+      continue;
+    }
+    if (victim == NULL ||
+        (entry->state == NEIGHBOR_INCOMPLETE &&
+         victim->state != NEIGHBOR_INCOMPLETE) ||
+        (entry->state == victim->state &&
+         NeighborLastSeen(entry) < NeighborLastSeen(victim))) {
+      victim = entry;
+    }
+  }
+  if (victim != NULL) {
+    NeighborDropHeld(table, victim);
+    memset(victim, 0, sizeof(NeighborEntry));
+    victim->ip = ip;
+    victim->if_index = if_index;
+    NeighborPublish(table, victim);
+  }
+  return victim;
+}
+
+// fills in the destination MAC address of an adjacency and marks it valid.
+// Packets are sent while it changes, so it is published as a seqlock: seq is
+// odd while the bytes are written, and NeighborCopyAdjacency retries until
+// it has read the header between two equal even values.
+static void NeighborUpdateAdjacency(HAL_Adjacency *adj, const macaddr_t mac) {
+  if (__atomic_load_n(&adj->valid, __ATOMIC_RELAXED) &&
+      memcmp(adj->header, mac, sizeof(macaddr_t)) == 0) {
+    return;
+  }
+  // writers hold the table lock, so there is only ever one
+  unsigned int seq = __atomic_load_n(&adj->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&adj->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (size_t i = 0; i < sizeof(macaddr_t); i++) {
+    __atomic_store_n(&adj->header[i], mac[i], __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&adj->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&adj->valid, 1, __ATOMIC_RELEASE);
+}
+
+// copies the Ethernet header of an attached adjacency, never half of an old
+// and half of a new MAC address; needs no lock
+static void NeighborCopyAdjacency(const HAL_Adjacency *adj, uint8_t *header) {
+  unsigned int seq;
+  do {
+    seq = __atomic_load_n(&adj->seq, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < sizeof(macaddr_t); i++) {
+      header[i] = __atomic_load_n(&adj->header[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) != 0 || __atomic_load_n(&adj->seq, __ATOMIC_RELAXED) != seq);
+  // the rest is written once, when it is attached
+  memcpy(&header[6], &adj->header[6], 8);
+}
+
+// records the MAC address of ip on if_index and releases the packets held
+// for it to their workers, returns how many there were
+static int NeighborLearn(NeighborTable *table, in_addr_t ip, int if_index,
+                         const macaddr_t mac, uint64_t now, bool permanent) {
+  NeighborEntry *entry = NeighborFind(table, ip, if_index, now);
+  if (entry == NULL) {
+    entry = NeighborAllocate(table, ip, if_index, now, true);
+  }
+  if (entry == NULL) {
+    return 0;
+  }
+  if (entry->state != NEIGHBOR_PERMANENT) {
+    entry->state = permanent ? NEIGHBOR_PERMANENT : NEIGHBOR_REACHABLE;
+  }
+  memcpy(entry->mac, mac, sizeof(macaddr_t));
+  entry->confirmed = now;
+  NeighborPublish(table, entry);
+  for (HAL_Adjacency *adj = table->adjacencies; adj != NULL; adj = adj->next) {
+    if (adj->ip == ip && adj->if_index == if_index) {
+      NeighborUpdateAdjacency(adj, mac);
+    }
+  }
+
+  // in the order they were held
+  int released = 0;
+  for (; entry->held_count > 0; entry->held_count--) {
+    int16_t index = entry->held_first;
+    NeighborHeld &held = table->held[index];
+    entry->held_first = held.next;
+    held.next = -1;
+    held.if_index = if_index;
+    memcpy(held.mac, mac, sizeof(macaddr_t));
+    int w = held.worker;
+    if (table->released_count[w] == 0) {
+      table->released_first[w] = index;
+    } else {
+      table->held[table->released_last[w]].next = index;
+    }
+    table->released_last[w] = index;
+    __atomic_store_n(&table->released_count[w], table->released_count[w] + 1,
+                     __ATOMIC_RELAXED);
+    released++;
+  }
+  return released;
+}
+
+// sends the packets released to worker since the last call, returns how many
+// there were. Takes the lock itself and only while the packets are moved,
+// they are sent without it; a worker with nothing released does not lock.
+static int NeighborSendReleased(NeighborTable *table, int worker,
+                                NeighborSender send) {
+  if (__atomic_load_n(&table->released_count[worker], __ATOMIC_RELAXED) == 0) {
+    return 0;
+  }
+  int16_t first;
+  int count;
+  {
+    std::lock_guard<std::mutex> lock(table->lock);
+    first = table->released_first[worker];
+    count = table->released_count[worker];
+    __atomic_store_n(&table->released_count[worker], 0, __ATOMIC_RELAXED);
+  }
+  // nobody else looks at these until they are freed
+  int16_t last = first;
+  for (int i = 0; i < count; i++) {
+    NeighborHeld &held = table->held[last];
+    send(held.if_index, held.packet, held.length, held.mac);
+    if (i + 1 < count) {
+      last = held.next;
+    }
+  }
+  std::lock_guard<std::mutex> lock(table->lock);
+  table->held[last].next = table->held_free;
+  table->held_free = first;
+  return count;
+}
+
+// keeps a copy of a packet for ip until NeighborLearn releases it to worker,
+// after NeighborResolve found it missing; returns false if the packet had to
+// be dropped
+static bool NeighborHold(NeighborTable *table, in_addr_t ip, int if_index,
+                         const uint8_t *packet, size_t length, uint64_t now,
+                         int worker) {
+  if (!table->held_inited) {
+    for (int i = 0; i < NEIGHBOR_HOLD_SIZE; i++) {
+      table->held[i].next = i + 1 < NEIGHBOR_HOLD_SIZE ? i + 1 : -1;
+    }
+    table->held_free = 0;
+    table->held_inited = true;
+  }
+  NeighborEntry *entry = NeighborFind(table, ip, if_index, now);
+  if (entry == NULL || entry->state != NEIGHBOR_INCOMPLETE ||
+      entry->held_count == NEIGHBOR_HOLD_LIMIT || table->held_free < 0 ||
+      length > NEIGHBOR_HOLD_MTU) {
+    table->hold_dropped[if_index]++;
+    return false;
+  }
+  int16_t index = table->held_free;
+  NeighborHeld &held = table->held[index];
+  table->held_free = held.next;
+  memcpy(held.packet, packet, length);
+  held.length = length;
+  held.next = -1;
+  held.worker = worker;
+  if (entry->held_count == 0) {
+    entry->held_first = index;
+  } else {
+    int16_t last = entry->held_first;
+    while (table->held[last].next >= 0) {
+      last = table->held[last].next;
+    }
+    table->held[last].next = index;
+  }
+  entry->held_count++;
+  return true;
+}
+
+// looks up the MAC address of ip on if_index. *request is set if an ARP
+// request should go out, either because the address is unknown or to confirm
+// one that has not been heard from in a while; the caller sends it after
+// unlocking the table.
+static bool NeighborResolve(NeighborTable *table, in_addr_t ip, int if_index,
+                            uint64_t now, macaddr_t o_mac, bool *request) {
+  NeighborEntry *entry = NeighborFind(table, ip, if_index, now);
+  bool found = entry != NULL && entry->state != NEIGHBOR_INCOMPLETE;
+  if (found) {
+    memcpy(o_mac, entry->mac, sizeof(macaddr_t));
+  }
+  if (entry == NULL) {
+    entry = NeighborAllocate(table, ip, if_index, now, false);
+    if (entry != NULL) {
+      entry->state = NEIGHBOR_INCOMPLETE;
+      NeighborPublish(table, entry);
+    }
+  }
+  *request = entry != NULL && entry->state != NEIGHBOR_PERMANENT &&
+             (entry->requested == 0 ||
+              entry->requested + NEIGHBOR_RETRY_TIME < now) &&
+             (!found || entry->confirmed + NEIGHBOR_REACHABLE_TIME < now);
+  if (*request) {
+    entry->requested = now;
+  }
+  return found;
+}
+
+// looks up the MAC address of ip on if_index without the lock. Only finds
+// neighbors that NeighborResolve would return without asking for them again;
+// for everything else, including addresses not known yet, it returns false
+// and the caller goes through NeighborResolve under the lock.
+static bool NeighborLookup(const NeighborTable *table, in_addr_t ip,
+                           int if_index, uint64_t now, macaddr_t o_mac) {
+  uint32_t hash = NeighborHash(ip, if_index);
+  for (uint32_t i = 0; i < NEIGHBOR_PROBE_LIMIT; i++) {
+    const NeighborPublished *pub =
+        &table->published[(hash + i) & (NEIGHBOR_TABLE_SIZE - 1)];
+    unsigned int seq;
+    bool match;
+    uint8_t state;
+    uint64_t confirmed;
+    do {
+      seq = __atomic_load_n(&pub->seq, __ATOMIC_ACQUIRE);
+      match = __atomic_load_n(&pub->ip, __ATOMIC_RELAXED) == ip &&
+              __atomic_load_n(&pub->if_index, __ATOMIC_RELAXED) == if_index;
+      state = __atomic_load_n(&pub->state, __ATOMIC_RELAXED);
+      confirmed = __atomic_load_n(&pub->confirmed, __ATOMIC_RELAXED);
+      for (size_t j = 0; j < sizeof(macaddr_t); j++) {
+        o_mac[j] = __atomic_load_n(&pub->mac[j], __ATOMIC_RELAXED);
+      }
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) != 0 ||
+             __atomic_load_n(&pub->seq, __ATOMIC_RELAXED) != seq);
+    if (!match || state == NEIGHBOR_FREE) {
+      continue;
+    }
+    // a stale address is confirmed by NeighborResolve
+    return state == NEIGHBOR_PERMANENT ||
+           (state == NEIGHBOR_REACHABLE &&
+            confirmed + NEIGHBOR_REACHABLE_TIME >= now);
+  }
+  return false;
+}
+
+// starts keeping adj up to date, if_mac is the MAC address of its interface
+static void NeighborAttach(NeighborTable *table, HAL_Adjacency *adj,
+                           const macaddr_t if_mac, uint64_t now) {
+  memset(adj->header, 0, sizeof(macaddr_t));
+  memcpy(&adj->header[6], if_mac, sizeof(macaddr_t));
+  // IPv4
+  adj->header[12] = 0x08;
+  adj->header[13] = 0x00;
+  adj->valid = 0;
+  adj->seq = 0;
+  NeighborEntry *entry = NeighborFind(table, adj->ip, adj->if_index, now);
+  if (entry != NULL && entry->state != NEIGHBOR_INCOMPLETE) {
+    NeighborUpdateAdjacency(adj, entry->mac);
+  }
+  adj->next = table->adjacencies;
+  table->adjacencies = adj;
+  // resolve it on the next NeighborMaintain instead of a second later
+  __atomic_store_n(&table->maintained, 0, __ATOMIC_RELAXED);
+}
+
+static void NeighborDetach(NeighborTable *table, HAL_Adjacency *adj) {
+  for (HAL_Adjacency **link = &table->adjacencies; *link != NULL;
+       link = &(*link)->next) {
+    if (*link == adj) {
+      *link = adj->next;
+      break;
+    }
+  }
+  __atomic_store_n(&adj->valid, 0, __ATOMIC_RELEASE);
+}
+
+// whether NeighborMaintain has anything to do, checked before taking the
+// lock so that the receive path does not take it on every call
+static bool NeighborMaintainDue(NeighborTable *table, uint64_t now) {
+  return __atomic_load_n(&table->maintained, __ATOMIC_RELAXED) +
+             NEIGHBOR_RETRY_TIME <=
+         now;
+}
+
+// Packets through an adjacency never look at the table, so this does on
+// their behalf what NeighborResolve would: unresolved and stale neighbors
+// are put into requests to be asked for after unlocking, and expired ones
+// are marked invalid. Runs at most once per NEIGHBOR_RETRY_TIME, or again
+// on the next call when there were more than NEIGHBOR_MAINTAIN_BURST
+// requests. Returns the number of requests.
+static int NeighborMaintain(NeighborTable *table, uint64_t now,
+                            NeighborRequest requests[NEIGHBOR_MAINTAIN_BURST]) {
+  if (!NeighborMaintainDue(table, now)) {
+    return 0;
+  }
+  __atomic_store_n(&table->maintained, now, __ATOMIC_RELAXED);
+  int count = 0;
+  for (HAL_Adjacency *adj = table->adjacencies; adj != NULL; adj = adj->next) {
+    if (count == NEIGHBOR_MAINTAIN_BURST) {
+      // those asked for already are skipped next time
+      __atomic_store_n(&table->maintained, 0, __ATOMIC_RELAXED);
+      break;
+    }
+    macaddr_t mac;
+    bool ask = false;
+    if (NeighborResolve(table, adj->ip, adj->if_index, now, mac, &ask)) {
+      NeighborUpdateAdjacency(adj, mac);
+    } else {
+      __atomic_store_n(&adj->valid, 0, __ATOMIC_RELEASE);
+    }
+    if (ask) {
+      requests[count].if_index = adj->if_index;
+      requests[count].ip = adj->ip;
+      count++;
+    }
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// don't include this file in your own code.
+// Packet counters behind HAL_GetStats. Every thread counts into a slot of its
+// own, padded to whole cache lines, so forwarding threads never write to the
+// same line; HAL_GetStats adds the slots up. A slot has one writer, so a
+// relaxed load and store is enough and the hot path pays no locked
+// instruction.
+#include "router_hal.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// threads beyond this many share slots, and may then lose a few counts
+const int STATS_SLOTS = 16;
+
+struct alignas(64) StatsSlot {
+  HAL_Stats ifaces[N_IFACE_ON_BOARD];
+};
+
+struct StatsTable {
+  StatsSlot slots[STATS_SLOTS];
+  // slots handed out so far
+  std::atomic<int> used;
+};
+
+// slot of the current thread, taken on its first count
+static thread_local int stats_slot = -1;
+
+static HAL_Stats *StatsLocal(StatsTable *table, int if_index) {
+  if (stats_slot < 0) {
+    stats_slot = table->used.fetch_add(1, std::memory_order_relaxed) % STATS_SLOTS;
+  }
+  return &table->slots[stats_slot].ifaces[if_index];
+}
+
+static inline void StatsAdd(uint64_t *counter, uint64_t value) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                   __ATOMIC_RELAXED);
+}
+
+static void StatsCountRx(StatsTable *table, int if_index, size_t length) {
+  HAL_Stats *stats = StatsLocal(table, if_index);
+  StatsAdd(&stats->rx_packets, 1);
+  StatsAdd(&stats->rx_bytes, length);
+}
+
+static void StatsCountTx(StatsTable *table, int if_index, size_t length) {
+  HAL_Stats *stats = StatsLocal(table, if_index);
+  StatsAdd(&stats->tx_packets, 1);
+  StatsAdd(&stats->tx_bytes, length);
+}
+
+static void StatsCountDrop(StatsTable *table, int if_index, int reason) {
+  if (if_index < 0 || if_index >= N_IFACE_ON_BOARD || reason < 0 ||
+      reason >= HAL_DROP_REASONS) {
+    return;
+  }
+  StatsAdd(&StatsLocal(table, if_index)->drops[reason], 1);
+}
+
+// adds up the counters of all threads for one interface
+static void StatsSum(StatsTable *table, int if_index, HAL_Stats *sum) {
+  memset(sum, 0, sizeof(HAL_Stats));
+  for (int i = 0; i < STATS_SLOTS; i++) {
+    HAL_Stats *stats = &table->slots[i].ifaces[if_index];
+    sum->rx_packets += __atomic_load_n(&stats->rx_packets, __ATOMIC_RELAXED);
+    sum->rx_bytes += __atomic_load_n(&stats->rx_bytes, __ATOMIC_RELAXED);
+    sum->tx_packets += __atomic_load_n(&stats->tx_packets, __ATOMIC_RELAXED);
+    sum->tx_bytes += __atomic_load_n(&stats->tx_bytes, __ATOMIC_RELAXED);
+    for (int j = 0; j < HAL_DROP_REASONS; j++) {
+      sum->drops[j] += __atomic_load_n(&stats->drops[j], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+#endif
@@ -1,20 +1,29 @@
 #include "router_hal.h"
 #include "router_hal_common.h"
+#include "../common/neighbor_table.h"
+#include "../common/stats.h"
 #include <stdio.h>
 
 #include <ifaddrs.h>
 #include <linux/if_packet.h>
-#include <map>
 #include <net/if.h>
 #include <net/if_arp.h>
+#include <limits.h>
+#include <linux/filter.h>
+#ifndef ROUTER_BACKEND_XDP
 #include <pcap.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
-#include <utility>
+#include <unistd.h>
+#include <atomic>
 
 #ifndef HAL_PLATFORM_TESTING
 #include "platform/standard.h"
@@ -29,11 +38,303 @@ int debugEnabled = 0;
 in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
 macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
 
-pcap_t *pcap_in_handles[N_IFACE_ON_BOARD];
+#ifdef ROUTER_BACKEND_XDP
+#include "xsk.h"
+
+// one AF_XDP socket per interface, frames are received and sent in place in
+// its UMEM. All sockets share the first UMEM when the kernel allows it, so
+// that frames can be forwarded between ports without a copy.
+XskSocket xsk_sockets[N_IFACE_ON_BOARD];
+XskUmem xsk_umems[N_IFACE_ON_BOARD];
+const size_t TX_FRAME_SIZE = XSK_MTU;
+#elif defined(HAL_LINUX_TPACKET)
+#include "tpacket_ring.h"
+
+const size_t TX_FRAME_SIZE = TPACKET_TX_MTU;
+#else
+#include "../common/frame_pool.h"
+
 pcap_t *pcap_out_handles[N_IFACE_ON_BOARD];
 
-std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
-std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
+// transmit queues, frames are built in place and handed to the kernel in
+// batches with sendmmsg on a raw socket
+const int TX_RING_SIZE = 64;
+const size_t TX_FRAME_SIZE = 2048;
+struct TxRing {
+  uint8_t frames[TX_RING_SIZE][TX_FRAME_SIZE];
+  // either one of the frames above or a frame pool buffer
+  struct iovec iovs[TX_RING_SIZE];
+  // frame pool buffer to release once sent, -1 for none
+  int owners[TX_RING_SIZE];
+  int count;
+};
+#endif
+
+// everything a forwarding thread receives and sends with. With more than one
+// worker, every worker has a socket on each interface and the kernel spreads
+// the frames over them by flow hash (PACKET_FANOUT_HASH).
+struct Worker {
+#ifdef ROUTER_BACKEND_XDP
+  // a single worker, it uses the sockets above
+#elif defined(HAL_LINUX_TPACKET)
+  // one socket per interface, frames are received and sent in place through
+  // the rings it shares with the kernel
+  TpacketRing tpacket_rings[N_IFACE_ON_BOARD];
+#else
+  pcap_t *pcap_in_handles[N_IFACE_ON_BOARD];
+  // pcap reuses its buffer, so received frames are copied in here
+  FramePool frame_pool;
+  TxRing tx_rings[N_IFACE_ON_BOARD];
+  int tx_sockets[N_IFACE_ON_BOARD];
+#endif
+  // ports this worker receives from
+  int rx_mask;
+  // receive fds of the ports being waited on, so that an idle router sleeps
+  // in epoll_wait instead of spinning
+  int epoll_fd;
+  int epoll_mask;
+  // see HAL_WakeWorker: set by the first wake since the worker last woke up,
+  // which also makes wake_fd readable; wake_fd is always in the epoll set
+  std::atomic<bool> wake_pending;
+  int wake_fd;
+  // where the next receive starts
+  int next_port;
+};
+Worker workers[HAL_MAX_WORKERS];
+int worker_count = 1;
+// see HAL_BindWorker
+thread_local Worker *worker = &workers[0];
+
+NeighborTable neighbors;
+StatsTable counters;
+
+static bool CanReceive(int if_index) {
+  if ((worker->rx_mask & (1 << if_index)) == 0) {
+    return false;
+  }
+#ifdef ROUTER_BACKEND_XDP
+  return xsk_sockets[if_index].fd >= 0;
+#elif defined(HAL_LINUX_TPACKET)
+  return worker->tpacket_rings[if_index].fd >= 0;
+#else
+  return worker->pcap_in_handles[if_index] != NULL;
+#endif
+}
+
+// fd that becomes readable when the port has frames, -1 if there is none
+static int ReceiveFd(int if_index) {
+#ifdef ROUTER_BACKEND_XDP
+  return xsk_sockets[if_index].fd;
+#elif defined(HAL_LINUX_TPACKET)
+  return worker->tpacket_rings[if_index].fd;
+#else
+  return pcap_get_selectable_fd(worker->pcap_in_handles[if_index]);
+#endif
+}
+
+static bool CanSend(int if_index) {
+#ifdef ROUTER_BACKEND_XDP
+  return xsk_sockets[if_index].fd >= 0;
+#elif defined(HAL_LINUX_TPACKET)
+  return worker->tpacket_rings[if_index].fd >= 0;
+#else
+  return pcap_out_handles[if_index] != NULL;
+#endif
+}
+
+// sends a complete Ethernet frame right away, returns negative on failure
+static int InjectFrame(int if_index, const uint8_t *frame, size_t length) {
+#ifdef ROUTER_BACKEND_XDP
+  XskSocket &xsk = xsk_sockets[if_index];
+  uint8_t *slot = length <= XSK_MTU ? XskTxSlot(&xsk) : NULL;
+  if (slot == NULL) {
+    return -1;
+  }
+  memcpy(slot, frame, length);
+  XskTxCommit(&xsk, length);
+  return XskFlush(&xsk);
+#elif defined(HAL_LINUX_TPACKET)
+  TpacketRing &ring = worker->tpacket_rings[if_index];
+  uint8_t *slot = length <= TPACKET_TX_MTU ? TpacketTxSlot(&ring) : NULL;
+  if (slot == NULL) {
+    return -1;
+  }
+  memcpy(slot, frame, length);
+  TpacketTxCommit(&ring, length);
+  return TpacketFlush(&ring);
+#else
+  return pcap_inject(pcap_out_handles[if_index], frame, length);
+#endif
+}
+
+static void FillEthernetHeader(uint8_t *frame, int if_index,
+                               const macaddr_t dst_mac) {
+  memcpy(frame, dst_mac, sizeof(macaddr_t));
+  memcpy(&frame[6], interface_mac[if_index], sizeof(macaddr_t));
+  // IPv4
+  frame[12] = 0x08;
+  frame[13] = 0x00;
+}
+
+// gives the buffer behind a frame back to where it came from
+static void ReleaseFrame(const HAL_Frame &frame) {
+#ifdef ROUTER_BACKEND_XDP
+  XskFree(&xsk_umems[frame.handle >> 56], frame.handle & ((1ULL << 56) - 1));
+#elif defined(HAL_LINUX_TPACKET)
+  TpacketRelease(&worker->tpacket_rings[frame.handle >> 32], (uint32_t)frame.handle);
+#else
+  FramePoolRelease(&worker->frame_pool, frame.handle);
+#endif
+}
+
+// broadcasts an ARP request for ip, the neighbor table decides when
+static void SendArpRequest(int if_index, in_addr_t ip) {
+  if (!CanSend(if_index)) {
+    return;
+  }
+  if (debugEnabled) {
+    fprintf(stderr,
+            "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
+            inet_ntoa(in_addr{ip}));
+  }
+  uint8_t buffer[64] = {0};
+  // dst mac
+  for (int i = 0; i < 6; i++) {
+    buffer[i] = 0xff;
+  }
+  // src mac
+  memcpy(&buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // ARP
+  buffer[12] = 0x08;
+  buffer[13] = 0x06;
+  // hardware type
+  buffer[15] = 0x01;
+  // protocol type
+  buffer[16] = 0x08;
+  // hardware size
+  buffer[18] = 0x06;
+  // protocol size
+  buffer[19] = 0x04;
+  // opcode
+  buffer[21] = 0x01;
+  // sender
+  memcpy(&buffer[22], interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  memcpy(&buffer[38], &ip, sizeof(in_addr_t));
+
+  InjectFrame(if_index, buffer, sizeof(buffer));
+}
+
+#ifndef ROUTER_BACKEND_XDP
+// fanout group of each port, shared by the sockets of all workers
+int fanout_ids[N_IFACE_ON_BOARD];
+
+// puts a receiving socket of worker w into the fanout group of the port. The
+// kernel hands every frame to one socket of the group by flow hash, so the
+// frames of a flow stay in order on one worker. Returns false if the socket
+// must not be received from, as it would see every frame.
+static bool JoinFanout(int w, int fd, int if_index) {
+  if (worker_count == 1) {
+    return true;
+  }
+  // fragments are hashed once reassembled, to stay with their flow
+  int arg = (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16;
+  if (w > 0) {
+    arg |= fanout_ids[if_index];
+    return fanout_ids[if_index] >= 0 &&
+           setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == 0;
+  }
+  // the first worker creates the group, with an id chosen by the kernel
+  arg |= PACKET_FANOUT_FLAG_UNIQUEID << 16;
+  int id = 0;
+  socklen_t len = sizeof(id);
+  fanout_ids[if_index] = -1;
+  if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == 0 &&
+      getsockopt(fd, SOL_PACKET, PACKET_FANOUT, &id, &len) == 0) {
+    fanout_ids[if_index] = id & 0xffff;
+  } else if (debugEnabled) {
+    fprintf(stderr,
+            "HAL_Init: flow hashing unavailable for %s, worker 0 receives all "
+            "of its frames\n",
+            interfaces[if_index]);
+  }
+  return true;
+}
+
+// opens the sockets of worker w on every interface
+static void OpenWorker(int w) {
+  Worker &wk = workers[w];
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+#ifdef HAL_LINUX_TPACKET
+    TpacketRing &ring = wk.tpacket_rings[i];
+    if (TpacketOpen(&ring, interfaces[i]) == 0) {
+      if (JoinFanout(w, ring.fd, i)) {
+        wk.rx_mask |= 1 << i;
+      } else {
+        // still sends, but its receive ring must not fill up with copies
+        struct sock_filter drop = BPF_STMT(BPF_RET | BPF_K, 0);
+        struct sock_fprog prog = {1, &drop};
+        setsockopt(ring.fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+                   sizeof(prog));
+      }
+      if (debugEnabled && w == 0) {
+        fprintf(stderr, "HAL_Init: TPACKET_V3 rings enabled for %s\n",
+                interfaces[i]);
+      }
+    } else if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_Init: TPACKET_V3 rings disabled for %s, either the "
+              "interface does not exist or permission is denied\n",
+              interfaces[i]);
+    }
+#else
+    char error_buffer[PCAP_ERRBUF_SIZE];
+    pcap_t *&handle = wk.pcap_in_handles[i];
+    handle = pcap_open_live(interfaces[i], BUFSIZ, 1, 1, error_buffer);
+    if (handle && !JoinFanout(w, pcap_fileno(handle), i)) {
+      pcap_close(handle);
+      handle = NULL;
+    }
+    if (handle) {
+      pcap_setnonblock(handle, 1, error_buffer);
+      wk.rx_mask |= 1 << i;
+      if (debugEnabled && w == 0) {
+        fprintf(stderr, "HAL_Init: pcap capture enabled for %s\n",
+                interfaces[i]);
+      }
+    } else if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_Init: pcap capture disabled for %s, either the interface "
+              "does not exist or permission is denied\n",
+              interfaces[i]);
+    }
+
+    // protocol 0: this socket only transmits
+    int &fd = wk.tx_sockets[i];
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    struct sockaddr_ll addr = {};
+    addr.sll_family = AF_PACKET;
+    addr.sll_ifindex = if_nametoindex(interfaces[i]);
+    if (fd >= 0 &&
+        (addr.sll_ifindex == 0 ||
+         bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd >= 0) {
+      // frames are complete, skip the qdisc layer
+      int one = 1;
+      setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    } else if (debugEnabled && w == 0) {
+      fprintf(stderr,
+              "HAL_Init: raw socket unavailable for %s, sending with pcap\n",
+              interfaces[i]);
+    }
+#endif
+  }
+}
+#endif
 
 extern "C" {
 int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
@@ -61,8 +362,8 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
         memcpy(interface_mac[i],
                ((struct sockaddr_ll *)ifa->ifa_addr)->sll_addr,
                sizeof(macaddr_t));
-        memcpy(arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
-               interface_mac[i], sizeof(macaddr_t));
+        NeighborLearn(&neighbors, if_addrs[i], i, interface_mac[i],
+                      HAL_GetTicks(), true);
         if (debugEnabled) {
           fprintf(stderr, "HAL_Init: found MAC addr of interface %s\n",
                   interfaces[i]);
@@ -73,35 +374,74 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   }
   freeifaddrs(ifaddr);
 
-  // init pcap handles
-  char error_buffer[PCAP_ERRBUF_SIZE];
+#ifdef ROUTER_BACKEND_XDP
   for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
-    pcap_in_handles[i] =
-        pcap_open_live(interfaces[i], BUFSIZ, 1, 1, error_buffer);
-    if (pcap_in_handles[i]) {
-      pcap_setnonblock(pcap_in_handles[i], 1, error_buffer);
+    // a UMEM of its own if sharing is not supported
+    if (XskOpen(&xsk_sockets[i], &xsk_umems[0], interfaces[i]) == 0 ||
+        (i > 0 && XskOpen(&xsk_sockets[i], &xsk_umems[i], interfaces[i]) == 0)) {
       if (debugEnabled) {
-        fprintf(stderr, "HAL_Init: pcap capture enabled for %s\n",
-                interfaces[i]);
-      }
-    } else {
-      if (debugEnabled) {
-        fprintf(stderr,
-                "HAL_Init: pcap capture disabled for %s, either the interface "
-                "does not exist or permission is denied\n",
+        fprintf(stderr, "HAL_Init: AF_XDP socket enabled for %s\n",
                 interfaces[i]);
       }
+    } else if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_Init: AF_XDP socket disabled for %s: %s\n", interfaces[i],
+              strerror(errno));
     }
+  }
+  workers[0].rx_mask = (1 << N_IFACE_ON_BOARD) - 1;
+#else
+#ifndef HAL_LINUX_TPACKET
+  char error_buffer[PCAP_ERRBUF_SIZE];
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
     pcap_out_handles[i] =
         pcap_open_live(interfaces[i], BUFSIZ, 1, 0, error_buffer);
   }
+#endif
+  for (int w = 0; w < worker_count; w++) {
+    OpenWorker(w);
+  }
+#endif
+
+  for (int w = 0; w < worker_count; w++) {
+    Worker &wk = workers[w];
+    wk.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (wk.epoll_fd < 0 && debugEnabled) {
+      fprintf(stderr,
+              "HAL_Init: epoll_create1 failed with %s, polling instead\n",
+              strerror(errno));
+    }
+    wk.wake_fd = -1;
+    if (wk.epoll_fd >= 0) {
+      wk.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      struct epoll_event event = {};
+      event.events = EPOLLIN;
+      // a bit beyond every port, the receive loop ignores it
+      event.data.u32 = N_IFACE_ON_BOARD;
+      if (wk.wake_fd >= 0 &&
+          epoll_ctl(wk.epoll_fd, EPOLL_CTL_ADD, wk.wake_fd, &event) < 0) {
+        close(wk.wake_fd);
+        wk.wake_fd = -1;
+      }
+      if (wk.wake_fd < 0) {
+        // nothing could wake it up early
+        close(wk.epoll_fd);
+        wk.epoll_fd = -1;
+        if (debugEnabled) {
+          fprintf(stderr,
+                  "HAL_Init: eventfd failed with %s, polling instead\n",
+                  strerror(errno));
+        }
+      }
+    }
+  }
 
   memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
 
   inited = true;
   // send igmp to join RIP multicast group
   for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
-    if (pcap_out_handles[i]) {
+    if (CanSend(i)) {
       HAL_JoinIGMPGroup(i, if_addrs[i]);
       if (debugEnabled) {
         fprintf(stderr, "HAL_Init: Joining RIP multicast group 224.0.0.9 for %s\n",
@@ -112,8 +452,53 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   return 0;
 }
 
+int HAL_SetWorkerCount(int n) {
+  if (inited || n < 1 || n > HAL_MAX_WORKERS) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+#ifdef ROUTER_BACKEND_XDP
+  // the rings of an AF_XDP socket and its UMEM take one producer each
+  if (n > 1) {
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+#endif
+  worker_count = n;
+  return 0;
+}
+
+int HAL_BindWorker(int w) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (w < 0 || w >= worker_count) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  worker = &workers[w];
+  return 0;
+}
+
+int HAL_WakeWorker(int w) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (w < 0 || w >= worker_count) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  Worker &wk = workers[w];
+  // pairs with TakeWake: the worker either finds the flag set, or it has
+  // cleared the flag and this write lands in its next epoll_wait
+  if (!wk.wake_pending.exchange(true) && wk.wake_fd >= 0) {
+    uint64_t one = 1;
+    if (write(wk.wake_fd, &one, sizeof(one)) < 0 && debugEnabled) {
+      fprintf(stderr, "HAL_WakeWorker: write failed with %s\n",
+              strerror(errno));
+    }
+  }
+  return 0;
+}
+
 uint64_t HAL_GetTicks() {
-  struct timespec tp = {0};
+  struct timespec tp = {};
   clock_gettime(CLOCK_MONOTONIC, &tp);
   // millisecond
   return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
@@ -135,53 +520,19 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
   }
 
   // lookup arp table
-  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
-  if (it != arp_table.end()) {
-    memcpy(o_mac, it->second, sizeof(macaddr_t));
-    return 0;
-  } else if (pcap_out_handles[if_index] &&
-             arp_timer[std::pair<in_addr_t, int>(ip, if_index)] + 1000 <
-                 HAL_GetTicks()) {
-    // not found, send arp request
-    // rate limit arp request by 1 req/s
-    arp_timer[std::pair<in_addr_t, int>(ip, if_index)] = HAL_GetTicks();
-    if (debugEnabled) {
-      fprintf(
-          stderr,
-          "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
-          inet_ntoa(in_addr{ip}));
-    }
-    uint8_t buffer[64] = {0};
-    // dst mac
-    for (int i = 0; i < 6; i++) {
-      buffer[i] = 0xff;
-    }
-    // src mac
-    macaddr_t mac;
-    HAL_GetInterfaceMacAddress(if_index, mac);
-    memcpy(&buffer[6], mac, sizeof(macaddr_t));
-    // ARP
-    buffer[12] = 0x08;
-    buffer[13] = 0x06;
-    // hardware type
-    buffer[15] = 0x01;
-    // protocol type
-    buffer[16] = 0x08;
-    // hardware size
-    buffer[18] = 0x06;
-    // protocol size
-    buffer[19] = 0x04;
-    // opcode
-    buffer[21] = 0x01;
-    // sender
-    memcpy(&buffer[22], mac, sizeof(macaddr_t));
-    memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
-    // target
-    memcpy(&buffer[38], &ip, sizeof(in_addr_t));
-
-    pcap_inject(pcap_out_handles[if_index], buffer, sizeof(buffer));
-  }
-  return HAL_ERR_IP_NOT_EXIST;
+  bool request = false;
+  bool found;
+  {
+    std::lock_guard<std::mutex> lock(neighbors.lock);
+    found = NeighborResolve(&neighbors, ip, if_index, HAL_GetTicks(), o_mac,
+                            &request);
+  }
+  if (request) {
+    // not found or not confirmed for a while, send arp request
+    // rate limited by the table to 1 req/s
+    SendArpRequest(if_index, ip);
+  }
+  return found ? 0 : HAL_ERR_IP_NOT_EXIST;
 }
 
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
@@ -196,20 +547,291 @@ int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   return 0;
 }
 
-int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
-                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
-                        int *if_index) {
+int HAL_GetStats(HAL_IN int if_index, HAL_OUT HAL_Stats *stats) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
-      (timeout < 0 && timeout != -1) || (if_index == NULL) || (buffer == NULL)) {
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || stats == NULL) {
     return HAL_ERR_INVALID_PARAMETER;
   }
+  StatsSum(&counters, if_index, stats);
+  // packets dropped while waiting for ARP are counted by the neighbor table
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  stats->drops[HAL_DROP_ARP_MISS] += neighbors.hold_dropped[if_index];
+  return 0;
+}
+
+void HAL_CountDrop(HAL_IN int if_index, HAL_IN int reason) {
+  StatsCountDrop(&counters, if_index, reason);
+}
+
+// NeighborSender for the packets held until their next hop was learned
+static void QueueHeld(int if_index, const uint8_t *packet, size_t length,
+                      const macaddr_t mac) {
+  HAL_PacketDesc desc;
+  desc.buffer = (uint8_t *)packet;
+  desc.length = length;
+  memcpy(desc.dst_mac, mac, sizeof(macaddr_t));
+  HAL_SendIPPackets(if_index, &desc, 1);
+}
+
+// sends what NeighborLearn released to this worker, ahead of anything else
+// it sends, so that a flow stays in order
+static void SendReleased() {
+  if (NeighborSendReleased(&neighbors, worker - workers, QueueHeld) > 0) {
+    // everything that waited goes out in one batch
+    HAL_FlushIPPackets(-1);
+  }
+}
+
+// handles one captured frame, returns true if it is an IPv4 packet for the
+// caller
+static bool HandleFrame(int current_port, const uint8_t *packet,
+                        size_t caplen) {
+  if (caplen >= IP_OFFSET &&
+      memcmp(&packet[6], interface_mac[current_port], sizeof(macaddr_t)) == 0) {
+    // skip outbound
+    return false;
+  } else if (caplen >= IP_OFFSET && packet[12] == 0x08 && packet[13] == 0x00) {
+    // IPv4
+    return true;
+  } else if (caplen >= IP_OFFSET && packet[12] == 0x08 && packet[13] == 0x06) {
+    // ARP
+    // learn it
+    macaddr_t mac;
+    memcpy(mac, &packet[22], sizeof(macaddr_t));
+    in_addr_t ip;
+    memcpy(&ip, &packet[28], sizeof(in_addr_t));
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      NeighborLearn(&neighbors, ip, current_port, mac, HAL_GetTicks(), false);
+    }
+    // packets held by other workers go out on their next call
+    SendReleased();
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+              inet_ntoa(in_addr{ip}));
+    }
+
+    in_addr_t dst_ip;
+    memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+    // ask me: reply
+    if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
+      // reply
+      uint8_t buffer[64] = {0};
+      // dst mac
+      memcpy(buffer, &packet[6], sizeof(macaddr_t));
+      // src mac
+      macaddr_t mac;
+      HAL_GetInterfaceMacAddress(current_port, mac);
+      memcpy(&buffer[6], mac, sizeof(macaddr_t));
+      // ARP
+      buffer[12] = 0x08;
+      buffer[13] = 0x06;
+      // hardware type
+      buffer[15] = 0x01;
+      // protocol type
+      buffer[16] = 0x08;
+      // hardware size
+      buffer[18] = 0x06;
+      // protocol size
+      buffer[19] = 0x04;
+      // opcode
+      buffer[21] = 0x02;
+      // sender
+      memcpy(&buffer[22], mac, sizeof(macaddr_t));
+      memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
+      // target
+      memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
+      memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
+
+      InjectFrame(current_port, buffer, sizeof(buffer));
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+                inet_ntoa(in_addr{ip}));
+      }
+    }
+    // otherwise: learn and ignore
+  }
+  return false;
+}
+
+// receives into either descs or frames, whichever is not NULL
+struct ReceiveContext {
+  HAL_PacketDesc *descs;
+  HAL_Frame *frames;
+  int n;
+  int count;
+  int port;
+};
+
+// hands an IPv4 frame accepted by HandleFrame to the caller, copied into the
+// next descriptor or left where it is as the next HAL_Frame
+static void DeliverPacket(ReceiveContext *ctx, uint8_t *packet, size_t caplen,
+                          uint64_t handle) {
+  // TODO: what if len != caplen
+  // Beware: might be larger than MTU because of offloading
+  size_t ip_len = caplen - IP_OFFSET;
+  StatsCountRx(&counters, ctx->port, ip_len);
+  if (ctx->frames) {
+    HAL_Frame &frame = ctx->frames[ctx->count];
+    frame.data = &packet[IP_OFFSET];
+    frame.length = ip_len;
+    frame.if_index = ctx->port;
+    memcpy(frame.dst_mac, &packet[0], sizeof(macaddr_t));
+    memcpy(frame.src_mac, &packet[6], sizeof(macaddr_t));
+    frame.handle = handle;
+  } else {
+    HAL_PacketDesc &desc = ctx->descs[ctx->count];
+    size_t real_length = desc.size > ip_len ? ip_len : desc.size;
+    memcpy(desc.buffer, &packet[IP_OFFSET], real_length);
+    memcpy(desc.dst_mac, &packet[0], sizeof(macaddr_t));
+    memcpy(desc.src_mac, &packet[6], sizeof(macaddr_t));
+    desc.length = ip_len;
+    desc.if_index = ctx->port;
+  }
+  ctx->count++;
+}
+
+#ifdef ROUTER_BACKEND_XDP
+static void ReceiveCallback(void *user, uint64_t addr, uint8_t *packet,
+                            size_t length) {
+  ReceiveContext *ctx = (ReceiveContext *)user;
+  XskSocket &xsk = xsk_sockets[ctx->port];
+  if (HandleFrame(ctx->port, packet, length)) {
+    if (ctx->frames) {
+      // the caller gets the UMEM frame itself
+      DeliverPacket(ctx, packet, length,
+                    addr | ((uint64_t)(xsk.umem - xsk_umems) << 56));
+      return;
+    }
+    DeliverPacket(ctx, packet, length, 0);
+  }
+  XskFree(xsk.umem, addr);
+}
+#elif !defined(HAL_LINUX_TPACKET)
+static void ReceiveCallback(u_char *user, const struct pcap_pkthdr *hdr,
+                            const u_char *packet) {
+  ReceiveContext *ctx = (ReceiveContext *)user;
+  if (ctx->count == ctx->n || !HandleFrame(ctx->port, packet, hdr->caplen)) {
+    return;
+  }
+  if (ctx->frames == NULL) {
+    DeliverPacket(ctx, (uint8_t *)packet, hdr->caplen, 0);
+    return;
+  }
+  // truncated packets cannot be forwarded, and a full pool drops the rest
+  if (hdr->caplen - IP_OFFSET > FRAME_POOL_MTU || hdr->caplen != hdr->len) {
+    StatsCountDrop(&counters, ctx->port, HAL_DROP_OVERSIZE);
+    return;
+  }
+  int index = FramePoolAlloc(&worker->frame_pool);
+  if (index < 0) {
+    StatsCountDrop(&counters, ctx->port, HAL_DROP_NO_BUFFER);
+    return;
+  }
+  uint8_t *frame = FramePoolData(&worker->frame_pool, index) - IP_OFFSET;
+  memcpy(frame, packet, hdr->caplen);
+  DeliverPacket(ctx, frame, hdr->caplen, index);
+}
+#endif
+
+// drains whatever the kernel has buffered for ctx->port in one go
+static void ReceiveFrames(ReceiveContext *ctx) {
+#ifdef ROUTER_BACKEND_XDP
+  // every frame taken off the ring may fill a descriptor
+  XskReceive(&xsk_sockets[ctx->port], ctx->n - ctx->count, ReceiveCallback,
+             ctx);
+#elif defined(HAL_LINUX_TPACKET)
+  TpacketRing &ring = worker->tpacket_rings[ctx->port];
+  uint8_t *frame;
+  size_t caplen;
+  while (ctx->count < ctx->n &&
+         (frame = TpacketNextFrame(&ring, &caplen)) != NULL) {
+    if (HandleFrame(ctx->port, frame, caplen)) {
+      // frames stay in the ring, their block is kept until they are released
+      uint64_t handle = 0;
+      if (ctx->frames) {
+        handle = ((uint64_t)ctx->port << 32) | TpacketHold(&ring);
+      }
+      DeliverPacket(ctx, frame, caplen, handle);
+    }
+  }
+#else
+  pcap_dispatch(worker->pcap_in_handles[ctx->port], ctx->n - ctx->count,
+                ReceiveCallback, (u_char *)ctx);
+#endif
+}
+
+// sleeps until a port in the mask has frames or timeout ms have passed,
+// returns the ports that became readable
+static int WaitForFrames(int if_index_mask, int64_t timeout) {
+  if (worker->epoll_fd < 0) {
+    return if_index_mask;
+  }
+  // keep the registered fds in line with the mask, so that traffic on other
+  // ports does not wake us up over and over
+  bool pollable = true;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    int bit = 1 << i;
+    if (!CanReceive(i) ||
+        ((if_index_mask ^ worker->epoll_mask) & bit) == 0) {
+      continue;
+    }
+    int fd = ReceiveFd(i);
+    if (fd < 0) {
+      pollable = false;
+      continue;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+    epoll_ctl(worker->epoll_fd,
+              (if_index_mask & bit) ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd,
+              &event);
+    worker->epoll_mask ^= bit;
+  }
+  if (!pollable && (timeout == -1 || timeout > 1)) {
+    // some port cannot be waited on, come back for it soon
+    timeout = 1;
+  } else if (timeout > INT_MAX) {
+    timeout = INT_MAX;
+  }
+
+  struct epoll_event events[N_IFACE_ON_BOARD];
+  int res = epoll_wait(worker->epoll_fd, events, N_IFACE_ON_BOARD, timeout);
+  int ready = 0;
+  for (int i = 0; i < res; i++) {
+    ready |= 1 << events[i].data.u32;
+  }
+  return ready;
+}
+
+// whether HAL_WakeWorker was called since the last time, resets it. The
+// eventfd is emptied first: a wake coming in between sets the flag again and
+// writes to it once more.
+static bool TakeWake() {
+  if (!worker->wake_pending.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  uint64_t count;
+  if (worker->wake_fd >= 0 &&
+      read(worker->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN &&
+      debugEnabled) {
+    fprintf(stderr, "HAL_ReceiveIPPacket: reading eventfd failed with %s\n",
+            strerror(errno));
+  }
+  // acquires what the waking thread did before HAL_WakeWorker
+  return worker->wake_pending.exchange(false);
+}
+
+// the part of HAL_ReceiveIPPackets and HAL_ReceiveFrames after the checks
+static int ReceivePackets(int if_index_mask, ReceiveContext *ctx,
+                          int64_t timeout) {
 
   bool flag = false;
   for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
-    if (pcap_in_handles[i] && (if_index_mask & (1 << i))) {
+    if (CanReceive(i) && (if_index_mask & (1 << i))) {
       flag = true;
     }
   }
@@ -223,97 +845,455 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
-  // Round robin
-  int current_port = 0;
-  struct pcap_pkthdr hdr;
+  // one worker keeps the adjacencies up to date, the others never wait for
+  // the neighbor table here
+  if (worker == &workers[0] && NeighborMaintainDue(&neighbors, begin)) {
+    NeighborRequest requests[NEIGHBOR_MAINTAIN_BURST];
+    int count;
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      count = NeighborMaintain(&neighbors, begin, requests);
+    }
+    for (int i = 0; i < count; i++) {
+      SendArpRequest(requests[i].if_index, requests[i].ip);
+    }
+  }
+  // Round robin, starting where the last call stopped so that a busy port
+  // cannot starve the others
+  int &next_port = worker->next_port;
+  // check every port first, after that only the ones reported readable
+  int ready = if_index_mask;
   do {
-    if ((if_index_mask & (1 << current_port)) == 0 ||
-        !pcap_in_handles[current_port]) {
-      current_port = (current_port + 1) % N_IFACE_ON_BOARD;
-      continue;
+    SendReleased();
+    for (int i = 0; i < N_IFACE_ON_BOARD && ctx->count < ctx->n; i++) {
+      int current_port = (next_port + i) % N_IFACE_ON_BOARD;
+      if ((if_index_mask & ready & (1 << current_port)) == 0 ||
+          !CanReceive(current_port)) {
+        continue;
+      }
+      ctx->port = current_port;
+      ReceiveFrames(ctx);
+    }
+    next_port = (next_port + 1) % N_IFACE_ON_BOARD;
+    if (ctx->count > 0) {
+      return ctx->count;
     }
+    if (TakeWake()) {
+      return 0;
+    }
+    current_time = HAL_GetTicks();
+    if (timeout == -1) {
+      ready = WaitForFrames(if_index_mask, -1);
+    } else if (current_time < begin + timeout) {
+      ready = WaitForFrames(if_index_mask, begin + timeout - current_time);
+    }
+    // -1 for infinity
+  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
+  return 0;
+}
 
-    const uint8_t *packet = pcap_next(pcap_in_handles[current_port], &hdr);
-    if (packet && hdr.caplen >= IP_OFFSET &&
-        memcmp(&packet[6], interface_mac[current_port], sizeof(macaddr_t)) ==
-            0) {
-      // skip outbound
-      continue;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x00) {
-      // IPv4
-      // TODO: what if len != caplen
-      // Beware: might be larger than MTU because of offloading
-      size_t ip_len = hdr.caplen - IP_OFFSET;
-      size_t real_length = length > ip_len ? ip_len : length;
-      memcpy(buffer, &packet[IP_OFFSET], real_length);
-      memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
-      memcpy(src_mac, &packet[6], sizeof(macaddr_t));
-      *if_index = current_port;
-      return ip_len;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x06) {
-      // ARP
-      // learn it
-      macaddr_t mac;
-      memcpy(mac, &packet[22], sizeof(macaddr_t));
-      in_addr_t ip;
-      memcpy(&ip, &packet[28], sizeof(in_addr_t));
-      memcpy(arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
-             sizeof(macaddr_t));
-      if (debugEnabled) {
-        fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
-                inet_ntoa(in_addr{ip}));
-      }
+int HAL_ReceiveIPPackets(int if_index_mask, HAL_PacketDesc *descs, int n,
+                         int64_t timeout) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (descs == NULL) || n <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  ReceiveContext ctx = {descs, NULL, n, 0, 0};
+  return ReceivePackets(if_index_mask, &ctx, timeout);
+}
 
-      in_addr_t dst_ip;
-      memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
-      // ask me: reply
-      if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
-        // reply
-        uint8_t buffer[64] = {0};
-        // dst mac
-        memcpy(buffer, &packet[6], sizeof(macaddr_t));
-        // src mac
-        macaddr_t mac;
-        HAL_GetInterfaceMacAddress(current_port, mac);
-        memcpy(&buffer[6], mac, sizeof(macaddr_t));
-        // ARP
-        buffer[12] = 0x08;
-        buffer[13] = 0x06;
-        // hardware type
-        buffer[15] = 0x01;
-        // protocol type
-        buffer[16] = 0x08;
-        // hardware size
-        buffer[18] = 0x06;
-        // protocol size
-        buffer[19] = 0x04;
-        // opcode
-        buffer[21] = 0x02;
-        // sender
-        memcpy(&buffer[22], mac, sizeof(macaddr_t));
-        memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
-        // target
-        memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
-        memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
-
-        pcap_inject(pcap_out_handles[current_port], buffer, sizeof(buffer));
+int HAL_ReceiveFrames(int if_index_mask, HAL_Frame *frames, int n,
+                      int64_t timeout) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (frames == NULL) || n <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  ReceiveContext ctx = {NULL, frames, n, 0, 0};
+  return ReceivePackets(if_index_mask, &ctx, timeout);
+}
+
+void HAL_ReleaseFrames(HAL_IN HAL_Frame *frames, HAL_IN int n) {
+  if (!inited || frames == NULL) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    ReleaseFrame(frames[i]);
+  }
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index == NULL) || (buffer == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  HAL_PacketDesc desc;
+  desc.buffer = buffer;
+  desc.size = length;
+  int res = HAL_ReceiveIPPackets(if_index_mask, &desc, 1, timeout);
+  if (res <= 0) {
+    return res;
+  }
+  memcpy(src_mac, desc.src_mac, sizeof(macaddr_t));
+  memcpy(dst_mac, desc.dst_mac, sizeof(macaddr_t));
+  *if_index = desc.if_index;
+  return desc.length;
+}
+
+static int FlushTxRing(int if_index) {
+#ifdef ROUTER_BACKEND_XDP
+  if (XskFlush(&xsk_sockets[if_index]) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_FlushIPPackets: sendto failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  return 0;
+#elif defined(HAL_LINUX_TPACKET)
+  TpacketRing &ring = worker->tpacket_rings[if_index];
+  if (ring.tx_pending == 0) {
+    return 0;
+  }
+  if (TpacketFlush(&ring) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_FlushIPPackets: send failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  return 0;
+#else
+  TxRing &ring = worker->tx_rings[if_index];
+  if (ring.count == 0) {
+    return 0;
+  }
+  int ret = 0;
+  if (worker->tx_sockets[if_index] >= 0) {
+    struct mmsghdr msgs[TX_RING_SIZE];
+    memset(msgs, 0, sizeof(struct mmsghdr) * ring.count);
+    for (int i = 0; i < ring.count; i++) {
+      msgs[i].msg_hdr.msg_iov = &ring.iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = 0;
+    while (sent < ring.count) {
+      int res = sendmmsg(worker->tx_sockets[if_index], &msgs[sent],
+                         ring.count - sent, 0);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (debugEnabled) {
+          fprintf(stderr, "HAL_FlushIPPackets: sendmmsg failed with %s\n",
+                  strerror(errno));
+        }
+        ret = HAL_ERR_UNKNOWN;
+        break;
+      }
+      sent += res;
+    }
+  } else {
+    for (int i = 0; i < ring.count; i++) {
+      if (pcap_inject(pcap_out_handles[if_index], ring.iovs[i].iov_base,
+                      ring.iovs[i].iov_len) < 0) {
         if (debugEnabled) {
-          fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
-                  inet_ntoa(in_addr{ip}));
+          fprintf(stderr, "HAL_FlushIPPackets: pcap_inject failed with %s\n",
+                  pcap_geterr(pcap_out_handles[if_index]));
         }
+        ret = HAL_ERR_UNKNOWN;
+      }
+    }
+  }
+  for (int i = 0; i < ring.count; i++) {
+    if (ring.owners[i] >= 0) {
+      FramePoolRelease(&worker->frame_pool, ring.owners[i]);
+    }
+  }
+  ring.count = 0;
+  return ret;
+#endif
+}
+
+// returns where the next queued frame of at most TX_FRAME_SIZE bytes goes
+static uint8_t *QueueSlot(int if_index) {
+#ifdef ROUTER_BACKEND_XDP
+  return XskTxSlot(&xsk_sockets[if_index]);
+#elif defined(HAL_LINUX_TPACKET)
+  return TpacketTxSlot(&worker->tpacket_rings[if_index]);
+#else
+  TxRing &ring = worker->tx_rings[if_index];
+  if (ring.count == TX_RING_SIZE) {
+    FlushTxRing(if_index);
+  }
+  return ring.frames[ring.count];
+#endif
+}
+
+static void QueueCommit(int if_index, size_t length) {
+  StatsCountTx(&counters, if_index, length - IP_OFFSET);
+#ifdef ROUTER_BACKEND_XDP
+  XskTxCommit(&xsk_sockets[if_index], length);
+#elif defined(HAL_LINUX_TPACKET)
+  TpacketTxCommit(&worker->tpacket_rings[if_index], length);
+#else
+  TxRing &ring = worker->tx_rings[if_index];
+  ring.iovs[ring.count].iov_base = ring.frames[ring.count];
+  ring.iovs[ring.count].iov_len = length;
+  ring.owners[ring.count] = -1;
+  ring.count++;
+#endif
+}
+
+// queues a frame from HAL_ReceiveFrames, the Ethernet header is copied right
+// in front of the packet; returns false if the frame had to be dropped, which
+// is counted here as callers tend to ignore it
+static bool QueueFrame(int if_index, const HAL_Frame &frame,
+                       const uint8_t *eth_header) {
+  size_t length = frame.length + IP_OFFSET;
+#if defined(ROUTER_BACKEND_XDP) || defined(HAL_LINUX_TPACKET)
+#ifdef ROUTER_BACKEND_XDP
+  XskSocket &xsk = xsk_sockets[if_index];
+  if (&xsk_umems[frame.handle >> 56] == xsk.umem) {
+    // already in memory the socket sends from, comes back on completion
+    uint8_t *header = frame.data - IP_OFFSET;
+    memcpy(header, eth_header, IP_OFFSET);
+    if (XskSubmit(&xsk, header - xsk.umem->area, length)) {
+      StatsCountTx(&counters, if_index, frame.length);
+      return true;
+    }
+    StatsCountDrop(&counters, if_index, HAL_DROP_NO_BUFFER);
+    ReleaseFrame(frame);
+    return false;
+  }
+#endif
+  // one copy into the transmit ring
+  uint8_t *slot = NULL;
+  if (length > TX_FRAME_SIZE) {
+    StatsCountDrop(&counters, if_index, HAL_DROP_OVERSIZE);
+  } else if ((slot = QueueSlot(if_index)) == NULL) {
+    StatsCountDrop(&counters, if_index, HAL_DROP_NO_BUFFER);
+  } else {
+    memcpy(slot, eth_header, IP_OFFSET);
+    memcpy(&slot[IP_OFFSET], frame.data, frame.length);
+    QueueCommit(if_index, length);
+  }
+  ReleaseFrame(frame);
+  return slot != NULL;
+#else
+  TxRing &ring = worker->tx_rings[if_index];
+  if (ring.count == TX_RING_SIZE) {
+    FlushTxRing(if_index);
+  }
+  uint8_t *header = frame.data - IP_OFFSET;
+  memcpy(header, eth_header, IP_OFFSET);
+  ring.iovs[ring.count].iov_base = header;
+  ring.iovs[ring.count].iov_len = length;
+  ring.owners[ring.count] = (int)frame.handle;
+  ring.count++;
+  StatsCountTx(&counters, if_index, frame.length);
+  return true;
+#endif
+}
+
+int HAL_SendIPPackets(HAL_IN int if_index, HAL_IN HAL_PacketDesc *descs,
+                      HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || descs == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (!CanSend(if_index)) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  for (int i = 0; i < n; i++) {
+    uint8_t *frame = NULL;
+    if (descs[i].length + IP_OFFSET <= TX_FRAME_SIZE) {
+      frame = QueueSlot(if_index);
+    }
+    if (frame == NULL) {
+      // e.g. offloaded super-frames: keep order and send it on its own
+      int res = FlushTxRing(if_index);
+      if (res == 0) {
+        res = HAL_SendIPPacket(if_index, descs[i].buffer, descs[i].length,
+                               descs[i].dst_mac);
+      }
+      if (res != 0) {
+        return i > 0 ? i : res;
       }
-      // otherwise: learn and ignore
       continue;
     }
+    FillEthernetHeader(frame, if_index, descs[i].dst_mac);
+    memcpy(&frame[IP_OFFSET], descs[i].buffer, descs[i].length);
+    QueueCommit(if_index, descs[i].length + IP_OFFSET);
+  }
+  return n;
+}
 
-    current_port = (current_port + 1) % N_IFACE_ON_BOARD;
-    // -1 for infinity
-  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
+int HAL_SendFrames(HAL_IN int if_index, HAL_IN HAL_Frame *frames,
+                   HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || !CanSend(if_index)) {
+    // the frames are ours either way
+    HAL_ReleaseFrames(frames, n);
+    return if_index >= N_IFACE_ON_BOARD || if_index < 0
+               ? HAL_ERR_INVALID_PARAMETER
+               : HAL_ERR_IFACE_NOT_EXIST;
+  }
+  SendReleased();
+  int queued = 0;
+  for (int i = 0; i < n; i++) {
+    uint8_t header[IP_OFFSET];
+    FillEthernetHeader(header, if_index, frames[i].dst_mac);
+    if (QueueFrame(if_index, frames[i], header)) {
+      queued++;
+    }
+  }
+  return queued;
+}
+
+int HAL_SendFramesVia(HAL_IN HAL_Adjacency *adj, HAL_IN HAL_Frame *frames,
+                      HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int if_index = adj->if_index;
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || !CanSend(if_index)) {
+    HAL_ReleaseFrames(frames, n);
+    return if_index >= N_IFACE_ON_BOARD || if_index < 0
+               ? HAL_ERR_INVALID_PARAMETER
+               : HAL_ERR_IFACE_NOT_EXIST;
+  }
+  SendReleased();
+  // the header was built when the neighbor was learned, read once per batch
+  uint8_t header[IP_OFFSET];
+  NeighborCopyAdjacency(adj, header);
+  int queued = 0;
+  for (int i = 0; i < n; i++) {
+    if (QueueFrame(if_index, frames[i], header)) {
+      queued++;
+    }
+  }
+  return queued;
+}
+
+int HAL_SendFramesToNeighbor(HAL_IN int if_index, HAL_IN in_addr_t ip,
+                             HAL_IN HAL_Frame *frames, HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || !CanSend(if_index)) {
+    HAL_ReleaseFrames(frames, n);
+    return if_index >= N_IFACE_ON_BOARD || if_index < 0
+               ? HAL_ERR_INVALID_PARAMETER
+               : HAL_ERR_IFACE_NOT_EXIST;
+  }
+  SendReleased();
+  macaddr_t mac;
+  uint64_t now = HAL_GetTicks();
+  // known neighbors are found without the lock
+  if (!NeighborMulticast(ip, mac) &&
+      !NeighborLookup(&neighbors, ip, if_index, now, mac)) {
+    bool request = false;
+    bool found;
+    int held = 0;
+    uint64_t dropped;
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      found = NeighborResolve(&neighbors, ip, if_index, now, mac, &request);
+      for (int i = 0; i < n && !found; i++) {
+        if (NeighborHold(&neighbors, ip, if_index, frames[i].data,
+                         frames[i].length, now, worker - workers)) {
+          held++;
+        }
+      }
+      dropped = neighbors.hold_dropped[if_index];
+    }
+    if (request) {
+      SendArpRequest(if_index, ip);
+    }
+    if (debugEnabled && !found && held < n) {
+      fprintf(stderr,
+              "HAL_SendFramesToNeighbor: %d packets to %s dropped, %llu "
+              "in total\n",
+              n - held, inet_ntoa(in_addr{ip}), (unsigned long long)dropped);
+    }
+    if (!found) {
+      HAL_ReleaseFrames(frames, n);
+      return held;
+    }
+  }
+  uint8_t header[IP_OFFSET];
+  FillEthernetHeader(header, if_index, mac);
+  int queued = 0;
+  for (int i = 0; i < n; i++) {
+    if (QueueFrame(if_index, frames[i], header)) {
+      queued++;
+    }
+  }
+  return queued;
+}
+
+int HAL_AttachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || adj->if_index >= N_IFACE_ON_BOARD || adj->if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // resolved by the receive path, which sends the ARP requests
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  NeighborAttach(&neighbors, adj, interface_mac[adj->if_index],
+                 HAL_GetTicks());
   return 0;
 }
 
+void HAL_DetachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  if (!inited || adj == NULL) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  NeighborDetach(&neighbors, adj);
+}
+
+int HAL_FlushIPPackets(HAL_IN int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < -1) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int ret = 0;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if ((if_index == -1 || if_index == i) && CanSend(i) &&
+        FlushTxRing(i) != 0) {
+      ret = HAL_ERR_UNKNOWN;
+    }
+  }
+  return ret;
+}
+
 int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t length,
                      HAL_IN macaddr_t dst_mac) {
   if (!inited) {
@@ -322,19 +1302,58 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t
   if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
-  if (!pcap_out_handles[if_index]) {
+  if (!CanSend(if_index)) {
     return HAL_ERR_IFACE_NOT_EXIST;
   }
+#if defined(ROUTER_BACKEND_XDP) || defined(HAL_LINUX_TPACKET)
+  // built straight into the transmit ring, behind anything already queued
+  uint8_t *frame = NULL;
+  if (length + IP_OFFSET <= TX_FRAME_SIZE) {
+    frame = QueueSlot(if_index);
+  }
+  if (frame != NULL) {
+    FillEthernetHeader(frame, if_index, dst_mac);
+    memcpy(&frame[IP_OFFSET], buffer, length);
+    QueueCommit(if_index, length + IP_OFFSET);
+    if (FlushTxRing(if_index) == 0) {
+      return 0;
+    }
+  } else if (debugEnabled) {
+    fprintf(stderr, "HAL_SendIPPacket: no room for %zu bytes in the ring\n",
+            length);
+  }
+  return HAL_ERR_UNKNOWN;
+#else
+  // anything already queued goes out first
+  FlushTxRing(if_index);
+
+  uint8_t eth_header[IP_OFFSET];
+  FillEthernetHeader(eth_header, if_index, dst_mac);
+  if (worker->tx_sockets[if_index] >= 0) {
+    // header and payload are gathered by the kernel, no copy needed
+    struct iovec iov[2];
+    iov[0].iov_base = eth_header;
+    iov[0].iov_len = IP_OFFSET;
+    iov[1].iov_base = (void *)buffer;
+    iov[1].iov_len = length;
+    if (writev(worker->tx_sockets[if_index], iov, 2) >= 0) {
+      StatsCountTx(&counters, if_index, length);
+      return 0;
+    }
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_SendIPPacket: writev failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+
   uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
-  memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
-  memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
-  // IPv4
-  eth_buffer[12] = 0x08;
-  eth_buffer[13] = 0x00;
+  memcpy(eth_buffer, eth_header, IP_OFFSET);
   memcpy(&eth_buffer[IP_OFFSET], buffer, length);
   if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + IP_OFFSET) >=
       0) {
     free(eth_buffer);
+    StatsCountTx(&counters, if_index, length);
     return 0;
   } else {
     if (debugEnabled) {
@@ -344,5 +1363,6 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t
     free(eth_buffer);
     return HAL_ERR_UNKNOWN;
   }
+#endif
 }
 }
@@ -0,0 +1,217 @@
+#ifndef __TPACKET_RING_H__
+#define __TPACKET_RING_H__
+
+// don't include this file in your own code.
+// AF_PACKET socket with TPACKET_V3 receive and transmit rings, used by the
+// Linux backend when HAL_LINUX_TPACKET is defined. Frames are read from and
+// written into memory shared with the kernel, so there is no per-packet
+// syscall and no copy other than the one into the caller's buffer. Frames
+// can also be held in place, which keeps their block from the kernel until
+// they are released.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const uint32_t TPACKET_FRAME_SIZE = 2048;
+const uint32_t TPACKET_RX_BLOCK_SIZE = 1 << 20;
+const uint32_t TPACKET_RX_BLOCK_COUNT = 8;
+// a partially filled block is handed over after this many milliseconds
+const uint32_t TPACKET_RX_BLOCK_TIMEOUT = 1;
+const uint32_t TPACKET_TX_BLOCK_SIZE = 1 << 16;
+const uint32_t TPACKET_TX_FRAME_COUNT = 256;
+// where the kernel expects the frame in a transmit slot
+const size_t TPACKET_TX_DATA_OFFSET =
+    TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+const size_t TPACKET_TX_MTU = TPACKET_FRAME_SIZE - TPACKET_TX_DATA_OFFSET;
+
+struct TpacketRing {
+  int fd;
+  uint8_t *map;
+  size_t map_size;
+  // block being read, and the frames left in it
+  uint32_t rx_block;
+  uint32_t rx_left;
+  struct tpacket3_hdr *rx_frame;
+  // held frames per block, and blocks read past while still held
+  uint32_t rx_refs[TPACKET_RX_BLOCK_COUNT];
+  bool rx_passed[TPACKET_RX_BLOCK_COUNT];
+  // next transmit slot, and how many slots wait for a send
+  uint8_t *tx_base;
+  uint32_t tx_next;
+  uint32_t tx_pending;
+};
+
+static int TpacketOpen(TpacketRing *ring, const char *ifname) {
+  memset(ring, 0, sizeof(TpacketRing));
+  ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if (ring->fd < 0) {
+    return -1;
+  }
+
+  int version = TPACKET_V3;
+  struct tpacket_req3 rx = {};
+  rx.tp_block_size = TPACKET_RX_BLOCK_SIZE;
+  rx.tp_block_nr = TPACKET_RX_BLOCK_COUNT;
+  rx.tp_frame_size = TPACKET_FRAME_SIZE;
+  rx.tp_frame_nr =
+      TPACKET_RX_BLOCK_SIZE / TPACKET_FRAME_SIZE * TPACKET_RX_BLOCK_COUNT;
+  rx.tp_retire_blk_tov = TPACKET_RX_BLOCK_TIMEOUT;
+  // the transmit ring is frame based, block fields are layout only
+  struct tpacket_req3 tx = {};
+  tx.tp_block_size = TPACKET_TX_BLOCK_SIZE;
+  tx.tp_block_nr =
+      TPACKET_TX_FRAME_COUNT * TPACKET_FRAME_SIZE / TPACKET_TX_BLOCK_SIZE;
+  tx.tp_frame_size = TPACKET_FRAME_SIZE;
+  tx.tp_frame_nr = TPACKET_TX_FRAME_COUNT;
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) < 0 ||
+      setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx)) < 0 ||
+      setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx)) < 0) {
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+  }
+
+  // receive ring first, transmit ring right after it
+  size_t rx_size = (size_t)TPACKET_RX_BLOCK_SIZE * TPACKET_RX_BLOCK_COUNT;
+  ring->map_size = rx_size + (size_t)TPACKET_TX_FRAME_COUNT * TPACKET_FRAME_SIZE;
+  void *map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+  struct sockaddr_ll addr = {};
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = if_nametoindex(ifname);
+  if (map == MAP_FAILED || addr.sll_ifindex == 0 ||
+      bind(ring->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (map != MAP_FAILED) {
+      munmap(map, ring->map_size);
+    }
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+  }
+  ring->map = (uint8_t *)map;
+  ring->tx_base = ring->map + rx_size;
+
+  // best effort: frames are complete, and we want everything on the wire
+  int one = 1;
+  setsockopt(ring->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+  struct packet_mreq mreq = {};
+  mreq.mr_ifindex = addr.sll_ifindex;
+  mreq.mr_type = PACKET_MR_PROMISC;
+  setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+  return 0;
+}
+
+// returns the next received frame in place, or NULL if the kernel has none
+// ready. The frame stays valid until the next call unless it is held.
+static uint8_t *TpacketNextFrame(TpacketRing *ring, size_t *caplen) {
+  for (;;) {
+    struct tpacket_block_desc *block =
+        (struct tpacket_block_desc *)(ring->map +
+                                      ring->rx_block * TPACKET_RX_BLOCK_SIZE);
+    if (ring->rx_frame == NULL) {
+      // a block still held from the last lap has not been refilled
+      if (ring->rx_passed[ring->rx_block] ||
+          (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+           TP_STATUS_USER) == 0) {
+        return NULL;
+      }
+      ring->rx_left = block->hdr.bh1.num_pkts;
+      ring->rx_frame =
+          (struct tpacket3_hdr *)((uint8_t *)block +
+                                  block->hdr.bh1.offset_to_first_pkt);
+    }
+    if (ring->rx_left > 0) {
+      break;
+    }
+    // the whole block has been read, give it back unless frames are held
+    if (ring->rx_refs[ring->rx_block] > 0) {
+      ring->rx_passed[ring->rx_block] = true;
+    } else {
+      __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                       __ATOMIC_RELEASE);
+    }
+    ring->rx_block = (ring->rx_block + 1) % TPACKET_RX_BLOCK_COUNT;
+    ring->rx_frame = NULL;
+  }
+
+  struct tpacket3_hdr *frame = ring->rx_frame;
+  ring->rx_left--;
+  ring->rx_frame =
+      (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+  *caplen = frame->tp_snaplen;
+  return (uint8_t *)frame + frame->tp_mac;
+}
+
+// keeps the frame last returned by TpacketNextFrame valid past the next call,
+// returns the block to pass to TpacketRelease
+static uint32_t TpacketHold(TpacketRing *ring) {
+  ring->rx_refs[ring->rx_block]++;
+  return ring->rx_block;
+}
+
+static void TpacketRelease(TpacketRing *ring, uint32_t block) {
+  if (--ring->rx_refs[block] == 0 && ring->rx_passed[block]) {
+    ring->rx_passed[block] = false;
+    struct tpacket_block_desc *desc =
+        (struct tpacket_block_desc *)(ring->map +
+                                      block * TPACKET_RX_BLOCK_SIZE);
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+  }
+}
+
+static struct tpacket3_hdr *TpacketTxHeader(TpacketRing *ring, uint32_t slot) {
+  return (struct tpacket3_hdr *)(ring->tx_base + slot * TPACKET_FRAME_SIZE);
+}
+
+// asks the kernel to send every committed slot and waits for it to finish
+static int TpacketFlush(TpacketRing *ring) {
+  ring->tx_pending = 0;
+  while (send(ring->fd, NULL, 0, 0) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// returns where the next frame of at most TPACKET_TX_MTU bytes goes, or NULL
+// if the ring cannot be drained
+static uint8_t *TpacketTxSlot(TpacketRing *ring) {
+  struct tpacket3_hdr *hdr = TpacketTxHeader(ring, ring->tx_next);
+  uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+  if (status != TP_STATUS_AVAILABLE) {
+    // wrapped around onto frames still owned by the kernel
+    TpacketFlush(ring);
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (status == TP_STATUS_WRONG_FORMAT) {
+      // the kernel rejected this frame, reuse the slot
+      __atomic_store_n(&hdr->tp_status, TP_STATUS_AVAILABLE, __ATOMIC_RELAXED);
+    } else if (status != TP_STATUS_AVAILABLE) {
+      return NULL;
+    }
+  }
+  return (uint8_t *)hdr + TPACKET_TX_DATA_OFFSET;
+}
+
+// hands the slot returned by TpacketTxSlot to the kernel, sent on flush
+static void TpacketTxCommit(TpacketRing *ring, size_t length) {
+  struct tpacket3_hdr *hdr = TpacketTxHeader(ring, ring->tx_next);
+  hdr->tp_len = length;
+  hdr->tp_snaplen = length;
+  hdr->tp_next_offset = 0;
+  __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+  ring->tx_next = (ring->tx_next + 1) % TPACKET_TX_FRAME_COUNT;
+  ring->tx_pending++;
+}
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef __XSK_H__
+#define __XSK_H__
+
+// don't include this file in your own code.
+// AF_XDP socket bound to queue 0 of an interface, used by the XDP backend.
+// A small XDP program redirects every frame of the interface into the socket,
+// frames live in a UMEM shared with the kernel and never become skbs when the
+// driver supports zero-copy. Sockets of different interfaces share one UMEM
+// where the kernel allows it, so a frame received on one port can be sent on
+// another without being copied. Only raw syscalls are used, so neither libbpf
+// nor libxdp is needed.
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+const uint32_t XSK_FRAME_SIZE = 2048;
+const uint32_t XSK_FRAME_COUNT = 16384;
+const uint32_t XSK_RING_SIZE = 2048;
+// the kernel stores received frames this far into a chunk, frames we build
+// start there as well so that every frame has the same headroom
+const uint32_t XSK_FRAME_OFFSET = XDP_PACKET_HEADROOM;
+const size_t XSK_MTU = XSK_FRAME_SIZE - XSK_FRAME_OFFSET;
+// free frames kept out of the fill rings for sending
+const uint32_t XSK_TX_RESERVE = XSK_RING_SIZE;
+// sendto only moves a small batch per call in copy mode
+const int XSK_KICK_RETRIES = 256;
+
+struct XskQueue {
+  uint8_t *map;
+  size_t map_size;
+  uint32_t *producer;
+  uint32_t *consumer;
+  uint32_t *flags;
+  void *ring;
+  // our side of the ring: producer for fill/tx, consumer for rx/completion
+  uint32_t cached;
+};
+
+// frame memory and the chunks in it that neither the kernel nor the router
+// holds
+struct XskUmem {
+  // socket that registered the UMEM, -1 until then
+  int fd;
+  uint8_t *area;
+  uint64_t free[XSK_FRAME_COUNT];
+  uint32_t free_count;
+};
+
+struct XskSocket {
+  int fd;
+  int map_fd;
+  int prog_fd;
+  int link_fd;
+  XskUmem *umem;
+  XskQueue rx, tx, fill, comp;
+  // frame handed out by XskTxSlot, not yet committed
+  uint64_t tx_slot;
+  bool tx_slot_valid;
+};
+
+static int XskBpf(int cmd, union bpf_attr *attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+static int XskMapQueue(int fd, XskQueue *queue, uint64_t pgoff,
+                       const struct xdp_ring_offset *off, size_t entry_size) {
+  queue->map_size = off->desc + XSK_RING_SIZE * entry_size;
+  void *map = mmap(NULL, queue->map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  queue->map = (uint8_t *)map;
+  queue->producer = (uint32_t *)(queue->map + off->producer);
+  queue->consumer = (uint32_t *)(queue->map + off->consumer);
+  queue->flags = (uint32_t *)(queue->map + off->flags);
+  queue->ring = queue->map + off->desc;
+  queue->cached = 0;
+  return 0;
+}
+
+// loads `return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);`
+// and attaches it to the interface, native mode first
+static int XskAttachProgram(XskSocket *xsk, int ifindex) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = 64;
+  xsk->map_fd = XskBpf(BPF_MAP_CREATE, &attr);
+  if (xsk->map_fd < 0) {
+    return -1;
+  }
+
+  struct bpf_insn insns[6];
+  memset(insns, 0, sizeof(insns));
+  // r2 = ctx->rx_queue_index
+  insns[0].code = BPF_LDX | BPF_MEM | BPF_W;
+  insns[0].dst_reg = BPF_REG_2;
+  insns[0].src_reg = BPF_REG_1;
+  insns[0].off = offsetof(struct xdp_md, rx_queue_index);
+  // r1 = &xsks, a 64-bit immediate taking two slots
+  insns[1].code = BPF_LD | BPF_DW | BPF_IMM;
+  insns[1].dst_reg = BPF_REG_1;
+  insns[1].src_reg = BPF_PSEUDO_MAP_FD;
+  insns[1].imm = xsk->map_fd;
+  // r3 = XDP_PASS, what happens when the queue has no socket
+  insns[3].code = BPF_ALU64 | BPF_MOV | BPF_K;
+  insns[3].dst_reg = BPF_REG_3;
+  insns[3].imm = XDP_PASS;
+  insns[4].code = BPF_JMP | BPF_CALL;
+  insns[4].imm = BPF_FUNC_redirect_map;
+  insns[5].code = BPF_JMP | BPF_EXIT;
+
+  const char license[] = "Dual MIT/GPL";
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.expected_attach_type = BPF_XDP;
+  attr.insns = (uint64_t)(uintptr_t)insns;
+  attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+  attr.license = (uint64_t)(uintptr_t)license;
+  xsk->prog_fd = XskBpf(BPF_PROG_LOAD, &attr);
+  if (xsk->prog_fd < 0) {
+    return -1;
+  }
+
+  // the program stays attached as long as the link fd is open
+  uint32_t modes[2] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+  for (int i = 0; i < 2; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xsk->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = modes[i];
+    xsk->link_fd = XskBpf(BPF_LINK_CREATE, &attr);
+    if (xsk->link_fd >= 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static void XskClose(XskSocket *xsk) {
+  int fds[4] = {xsk->link_fd, xsk->prog_fd, xsk->map_fd, xsk->fd};
+  for (int i = 0; i < 4; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+  XskQueue *queues[4] = {&xsk->rx, &xsk->tx, &xsk->fill, &xsk->comp};
+  for (int i = 0; i < 4; i++) {
+    if (queues[i]->map) {
+      munmap(queues[i]->map, queues[i]->map_size);
+    }
+  }
+  memset(xsk, 0, sizeof(XskSocket));
+  xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+}
+
+static void XskFree(XskUmem *umem, uint64_t addr) {
+  umem->free[umem->free_count++] = addr & ~(uint64_t)(XSK_FRAME_SIZE - 1);
+}
+
+// tops the fill ring up from the free chunks
+static void XskRefill(XskSocket *xsk) {
+  XskUmem *umem = xsk->umem;
+  uint32_t used =
+      xsk->fill.cached - __atomic_load_n(xsk->fill.consumer, __ATOMIC_ACQUIRE);
+  uint32_t count = XSK_RING_SIZE - used;
+  if (umem->free_count < XSK_TX_RESERVE + count) {
+    count = umem->free_count > XSK_TX_RESERVE
+                ? umem->free_count - XSK_TX_RESERVE
+                : 0;
+  }
+  if (count == 0) {
+    return;
+  }
+  uint64_t *fill = (uint64_t *)xsk->fill.ring;
+  for (uint32_t i = 0; i < count; i++) {
+    fill[(xsk->fill.cached + i) & (XSK_RING_SIZE - 1)] =
+        umem->free[--umem->free_count];
+  }
+  xsk->fill.cached += count;
+  __atomic_store_n(xsk->fill.producer, xsk->fill.cached, __ATOMIC_RELEASE);
+}
+
+// binds to queue 0 of the interface, registering umem on the first call and
+// sharing it afterwards
+static int XskOpen(XskSocket *xsk, XskUmem *umem, const char *ifname) {
+  memset(xsk, 0, sizeof(XskSocket));
+  xsk->fd = xsk->map_fd = xsk->prog_fd = xsk->link_fd = -1;
+  xsk->umem = umem;
+  int ifindex = if_nametoindex(ifname);
+  if (ifindex == 0) {
+    return -1;
+  }
+
+  if (umem->area == NULL) {
+    void *area = mmap(NULL, (size_t)XSK_FRAME_COUNT * XSK_FRAME_SIZE,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (area == MAP_FAILED) {
+      return -1;
+    }
+    umem->area = (uint8_t *)area;
+    umem->fd = -1;
+    for (uint32_t i = 0; i < XSK_FRAME_COUNT; i++) {
+      umem->free[i] = (uint64_t)(XSK_FRAME_COUNT - 1 - i) * XSK_FRAME_SIZE;
+    }
+    umem->free_count = XSK_FRAME_COUNT;
+  }
+  xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+  if (xsk->fd < 0) {
+    XskClose(xsk);
+    return -1;
+  }
+
+  struct xdp_umem_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.addr = (uint64_t)(uintptr_t)umem->area;
+  reg.len = (uint64_t)XSK_FRAME_COUNT * XSK_FRAME_SIZE;
+  reg.chunk_size = XSK_FRAME_SIZE;
+  uint32_t size = XSK_RING_SIZE;
+  struct xdp_mmap_offsets off;
+  socklen_t optlen = sizeof(off);
+  // every socket needs its own fill and completion ring, as they sit on
+  // different interfaces
+  if ((umem->fd < 0 &&
+       setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) ||
+      setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) <
+          0 ||
+      setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+                 sizeof(size)) < 0 ||
+      setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0 ||
+      getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0 ||
+      XskMapQueue(xsk->fd, &xsk->fill, XDP_UMEM_PGOFF_FILL_RING, &off.fr,
+                  sizeof(uint64_t)) < 0 ||
+      XskMapQueue(xsk->fd, &xsk->comp, XDP_UMEM_PGOFF_COMPLETION_RING,
+                  &off.cr, sizeof(uint64_t)) < 0 ||
+      XskMapQueue(xsk->fd, &xsk->rx, XDP_PGOFF_RX_RING, &off.rx,
+                  sizeof(struct xdp_desc)) < 0 ||
+      XskMapQueue(xsk->fd, &xsk->tx, XDP_PGOFF_TX_RING, &off.tx,
+                  sizeof(struct xdp_desc)) < 0) {
+    XskClose(xsk);
+    return -1;
+  }
+
+  struct sockaddr_xdp addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sxdp_family = AF_XDP;
+  addr.sxdp_ifindex = ifindex;
+  addr.sxdp_queue_id = 0;
+  if (umem->fd >= 0) {
+    // the mode was chosen by the socket that registered the UMEM
+    addr.sxdp_flags = XDP_SHARED_UMEM;
+    addr.sxdp_shared_umem_fd = umem->fd;
+    if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      XskClose(xsk);
+      return -1;
+    }
+  } else {
+    // zero-copy needs driver support, veth and friends fall back to copying
+    addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+      if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        XskClose(xsk);
+        return -1;
+      }
+    }
+  }
+
+  uint32_t queue = 0;
+  if (XskAttachProgram(xsk, ifindex) < 0) {
+    XskClose(xsk);
+    return -1;
+  }
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = xsk->map_fd;
+  attr.key = (uint64_t)(uintptr_t)&queue;
+  attr.value = (uint64_t)(uintptr_t)&xsk->fd;
+  if (XskBpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+    XskClose(xsk);
+    return -1;
+  }
+  if (umem->fd < 0) {
+    umem->fd = xsk->fd;
+  }
+  XskRefill(xsk);
+  return 0;
+}
+
+// the handler owns the frame at addr and must give it back with XskFree
+typedef void (*XskHandler)(void *user, uint64_t addr, uint8_t *frame,
+                           size_t length);
+
+// calls handler for up to n received frames, returns how many there were
+static int XskReceive(XskSocket *xsk, int n, XskHandler handler, void *user) {
+  uint32_t available =
+      __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE) - xsk->rx.cached;
+  uint32_t count = available < (uint32_t)n ? available : (uint32_t)n;
+  struct xdp_desc *descs = (struct xdp_desc *)xsk->rx.ring;
+  for (uint32_t i = 0; i < count; i++) {
+    const struct xdp_desc &desc =
+        descs[(xsk->rx.cached + i) & (XSK_RING_SIZE - 1)];
+    handler(user, desc.addr, xsk->umem->area + desc.addr, (size_t)desc.len);
+  }
+  xsk->rx.cached += count;
+  __atomic_store_n(xsk->rx.consumer, xsk->rx.cached, __ATOMIC_RELEASE);
+  XskRefill(xsk);
+  if (__atomic_load_n(xsk->fill.flags, __ATOMIC_RELAXED) &
+      XDP_RING_NEED_WAKEUP) {
+    recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+  }
+  return count;
+}
+
+// takes back transmit frames the kernel is done with
+static void XskReclaim(XskSocket *xsk) {
+  uint32_t done =
+      __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE) - xsk->comp.cached;
+  uint64_t *comp = (uint64_t *)xsk->comp.ring;
+  for (uint32_t i = 0; i < done; i++) {
+    XskFree(xsk->umem, comp[(xsk->comp.cached + i) & (XSK_RING_SIZE - 1)]);
+  }
+  xsk->comp.cached += done;
+  __atomic_store_n(xsk->comp.consumer, xsk->comp.cached, __ATOMIC_RELEASE);
+}
+
+// makes the kernel send the whole transmit ring
+static int XskFlush(XskSocket *xsk) {
+  for (int i = 0; i < XSK_KICK_RETRIES; i++) {
+    if (__atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE) == xsk->tx.cached) {
+      break;
+    }
+    if (sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+        errno != EINTR) {
+      return -1;
+    }
+  }
+  XskReclaim(xsk);
+  return 0;
+}
+
+// queues length bytes at addr in the UMEM for sending, the frame goes back to
+// the free chunks once sent; returns false if the transmit ring stays full
+static bool XskSubmit(XskSocket *xsk, uint64_t addr, size_t length) {
+  if (xsk->tx.cached - __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE) ==
+      XSK_RING_SIZE) {
+    XskFlush(xsk);
+    if (xsk->tx.cached -
+            __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE) ==
+        XSK_RING_SIZE) {
+      return false;
+    }
+  }
+  struct xdp_desc *descs = (struct xdp_desc *)xsk->tx.ring;
+  struct xdp_desc &desc = descs[xsk->tx.cached & (XSK_RING_SIZE - 1)];
+  desc.addr = addr;
+  desc.len = length;
+  desc.options = 0;
+  xsk->tx.cached++;
+  __atomic_store_n(xsk->tx.producer, xsk->tx.cached, __ATOMIC_RELEASE);
+  return true;
+}
+
+// returns where the next frame of at most XSK_MTU bytes goes, or NULL if
+// every frame is in use
+static uint8_t *XskTxSlot(XskSocket *xsk) {
+  if (!xsk->tx_slot_valid) {
+    XskUmem *umem = xsk->umem;
+    if (umem->free_count == 0) {
+      XskReclaim(xsk);
+    }
+    if (umem->free_count == 0) {
+      XskFlush(xsk);
+    }
+    if (umem->free_count == 0) {
+      return NULL;
+    }
+    xsk->tx_slot = umem->free[--umem->free_count] + XSK_FRAME_OFFSET;
+    xsk->tx_slot_valid = true;
+  }
+  return xsk->umem->area + xsk->tx_slot;
+}
+
+// queues the frame returned by XskTxSlot, sent on flush
+static void XskTxCommit(XskSocket *xsk, size_t length) {
+  xsk->tx_slot_valid = false;
+  if (!XskSubmit(xsk, xsk->tx_slot, length)) {
+    XskFree(xsk->umem, xsk->tx_slot);
+  }
+}
+
+#endif
@@ -1,9 +1,11 @@
 #include "router_hal.h"
 #include "router_hal_common.h"
+#include "../common/frame_pool.h"
+#include "../common/neighbor_table.h"
+#include "../common/stats.h"
 #include <stdio.h>
 
 #include <ifaddrs.h>
-#include <map>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <net/if_dl.h>
@@ -16,7 +18,7 @@
 #include <sys/sysctl.h>
 #include <sys/types.h>
 #include <time.h>
-#include <utility>
+#include <atomic>
 
 const int IP_OFFSET = 14;
 
@@ -29,19 +31,73 @@ const char *interfaces[N_IFACE_ON_BOARD] = {
 
 bool inited = false;
 int debugEnabled = 0;
+// see HAL_WakeWorker, the receive loop polls it
+std::atomic<bool> wake_pending(false);
 in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
 macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
 
 pcap_t *pcap_in_handles[N_IFACE_ON_BOARD];
 pcap_t *pcap_out_handles[N_IFACE_ON_BOARD];
-
-// workaround for clang
-struct macaddr_wrap {
-  macaddr_t mac;
+// buffers behind HAL_ReceiveFrames
+FramePool frame_pool;
+
+// transmit queues, frames are built in place and injected on flush
+const int TX_RING_SIZE = 64;
+const int TX_FRAME_SIZE = 2048;
+struct TxRing {
+  uint8_t frames[TX_RING_SIZE][TX_FRAME_SIZE];
+  // either one of the frames above or a frame pool buffer
+  uint8_t *starts[TX_RING_SIZE];
+  size_t lengths[TX_RING_SIZE];
+  // frame pool buffer to release once sent, -1 for none
+  int owners[TX_RING_SIZE];
+  int count;
 };
+TxRing tx_rings[N_IFACE_ON_BOARD];
 
-std::map<std::pair<in_addr_t, int>, macaddr_wrap> arp_table;
-std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
+NeighborTable neighbors;
+StatsTable counters;
+
+// broadcasts an ARP request for ip, the neighbor table decides when
+static void SendArpRequest(int if_index, in_addr_t ip) {
+  if (!pcap_out_handles[if_index]) {
+    return;
+  }
+  if (debugEnabled) {
+    struct in_addr addr;
+    addr.s_addr = ip;
+    fprintf(stderr,
+            "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
+            inet_ntoa(addr));
+  }
+  uint8_t buffer[64] = {0};
+  // dst mac
+  for (int i = 0; i < 6; i++) {
+    buffer[i] = 0xff;
+  }
+  // src mac
+  memcpy(&buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // ARP
+  buffer[12] = 0x08;
+  buffer[13] = 0x06;
+  // hardware type
+  buffer[15] = 0x01;
+  // protocol type
+  buffer[16] = 0x08;
+  // hardware size
+  buffer[18] = 0x06;
+  // protocol size
+  buffer[19] = 0x04;
+  // opcode
+  buffer[21] = 0x01;
+  // sender
+  memcpy(&buffer[22], interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  memcpy(&buffer[38], &ip, sizeof(in_addr_t));
+
+  pcap_inject(pcap_out_handles[if_index], buffer, sizeof(buffer));
+}
 
 extern "C" {
 int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
@@ -110,8 +166,8 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
     caddr_t mac = LLADDR(sdl);
     // found
     memcpy(interface_mac[i], mac, sizeof(macaddr_t));
-    memcpy(&arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
-           interface_mac[i], sizeof(macaddr_t));
+    NeighborLearn(&neighbors, if_addrs[i], i, interface_mac[i], HAL_GetTicks(),
+                  true);
     if (debugEnabled) {
       macaddr_t m;
       // handle signedness
@@ -161,6 +217,32 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   return 0;
 }
 
+int HAL_SetWorkerCount(int n) {
+  if (inited || n < 1 || n > HAL_MAX_WORKERS) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // one set of pcap handles, driven from one thread
+  return n == 1 ? 0 : HAL_ERR_NOT_SUPPORTED;
+}
+
+int HAL_BindWorker(int worker) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  return worker == 0 ? 0 : HAL_ERR_INVALID_PARAMETER;
+}
+
+int HAL_WakeWorker(int worker) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (worker != 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  wake_pending = true;
+  return 0;
+}
+
 uint64_t HAL_GetTicks() {
   struct timespec tp = {0};
   clock_gettime(CLOCK_MONOTONIC, &tp);
@@ -186,53 +268,17 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
     return 0;
   }
 
-  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
-  if (it != arp_table.end()) {
-    memcpy(o_mac, &it->second, sizeof(macaddr_t));
-    return 0;
-  } else if (pcap_out_handles[if_index] &&
-             arp_timer[std::pair<in_addr_t, int>(ip, if_index)] + 1000 <
-                 HAL_GetTicks()) {
-    arp_timer[std::pair<in_addr_t, int>(ip, if_index)] = HAL_GetTicks();
-    if (debugEnabled) {
-      struct in_addr addr;
-      addr.s_addr = ip;
-      fprintf(
-          stderr,
-          "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
-          inet_ntoa(addr));
-    }
-    uint8_t buffer[64] = {0};
-    // dst mac
-    for (int i = 0; i < 6; i++) {
-      buffer[i] = 0xff;
-    }
-    // src mac
-    macaddr_t mac;
-    HAL_GetInterfaceMacAddress(if_index, mac);
-    memcpy(&buffer[6], mac, sizeof(macaddr_t));
-    // ARP
-    buffer[12] = 0x08;
-    buffer[13] = 0x06;
-    // hardware type
-    buffer[15] = 0x01;
-    // protocol type
-    buffer[16] = 0x08;
-    // hardware size
-    buffer[18] = 0x06;
-    // protocol size
-    buffer[19] = 0x04;
-    // opcode
-    buffer[21] = 0x01;
-    // sender
-    memcpy(&buffer[22], mac, sizeof(macaddr_t));
-    memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
-    // target
-    memcpy(&buffer[38], &ip, sizeof(in_addr_t));
-
-    pcap_inject(pcap_out_handles[if_index], buffer, sizeof(buffer));
-  }
-  return HAL_ERR_IP_NOT_EXIST;
+  bool request = false;
+  bool found;
+  {
+    std::lock_guard<std::mutex> lock(neighbors.lock);
+    found = NeighborResolve(&neighbors, ip, if_index, HAL_GetTicks(), o_mac,
+                            &request);
+  }
+  if (request) {
+    SendArpRequest(if_index, ip);
+  }
+  return found ? 0 : HAL_ERR_IP_NOT_EXIST;
 }
 
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
@@ -247,14 +293,141 @@ int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   return 0;
 }
 
-int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
-                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
-                        int *if_index) {
+int HAL_GetStats(HAL_IN int if_index, HAL_OUT HAL_Stats *stats) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || stats == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  StatsSum(&counters, if_index, stats);
+  // packets dropped while waiting for ARP are counted by the neighbor table
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  stats->drops[HAL_DROP_ARP_MISS] += neighbors.hold_dropped[if_index];
+  return 0;
+}
+
+void HAL_CountDrop(HAL_IN int if_index, HAL_IN int reason) {
+  StatsCountDrop(&counters, if_index, reason);
+}
+
+// NeighborSender for the packets held until their next hop was learned
+static void QueueHeld(int if_index, const uint8_t *packet, size_t length,
+                      const macaddr_t mac) {
+  HAL_PacketDesc desc;
+  desc.buffer = (uint8_t *)packet;
+  desc.length = length;
+  memcpy(desc.dst_mac, mac, sizeof(macaddr_t));
+  HAL_SendIPPackets(if_index, &desc, 1);
+}
+
+// handles one captured frame, returns true if it was an IPv4 packet that has
+// been copied into desc
+static bool HandleFrame(int current_port, const uint8_t *packet, size_t caplen,
+                        HAL_PacketDesc *desc) {
+  if (caplen >= IP_OFFSET &&
+      memcmp(&packet[6], interface_mac[current_port], sizeof(macaddr_t)) == 0) {
+    // skip outbound
+    return false;
+  } else if (caplen >= IP_OFFSET && packet[12] == 0x08 && packet[13] == 0x00) {
+    // IPv4
+    // TODO: what if len != caplen
+    size_t ip_len = caplen - IP_OFFSET;
+    size_t real_length = desc->size > ip_len ? ip_len : desc->size;
+    memcpy(desc->buffer, &packet[IP_OFFSET], real_length);
+    memcpy(desc->dst_mac, &packet[0], sizeof(macaddr_t));
+    memcpy(desc->src_mac, &packet[6], sizeof(macaddr_t));
+    desc->length = ip_len;
+    desc->if_index = current_port;
+    return true;
+  } else if (caplen >= IP_OFFSET && packet[12] == 0x08 && packet[13] == 0x06) {
+    // ARP
+    macaddr_t mac;
+    memcpy(mac, &packet[22], sizeof(macaddr_t));
+    in_addr_t ip;
+    memcpy(&ip, &packet[28], sizeof(in_addr_t));
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      NeighborLearn(&neighbors, ip, current_port, mac, HAL_GetTicks(), false);
+    }
+    if (NeighborSendReleased(&neighbors, 0, QueueHeld) > 0) {
+      // everything that waited for it goes out in one batch
+      HAL_FlushIPPackets(current_port);
+    }
+    if (debugEnabled) {
+      struct in_addr addr;
+      addr.s_addr = ip;
+      fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+              inet_ntoa(addr));
+    }
+
+    in_addr_t dst_ip;
+    memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+    if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
+      // reply
+      uint8_t buffer[64] = {0};
+      // dst mac
+      memcpy(buffer, &packet[6], sizeof(macaddr_t));
+      // src mac
+      macaddr_t mac;
+      HAL_GetInterfaceMacAddress(current_port, mac);
+      memcpy(&buffer[6], mac, sizeof(macaddr_t));
+      // ARP
+      buffer[12] = 0x08;
+      buffer[13] = 0x06;
+      // hardware type
+      buffer[15] = 0x01;
+      // protocol type
+      buffer[16] = 0x08;
+      // hardware size
+      buffer[18] = 0x06;
+      // protocol size
+      buffer[19] = 0x04;
+      // opcode
+      buffer[21] = 0x02;
+      // sender
+      memcpy(&buffer[22], mac, sizeof(macaddr_t));
+      memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
+      // target
+      memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
+      memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
+
+      pcap_inject(pcap_out_handles[current_port], buffer, sizeof(buffer));
+      if (debugEnabled) {
+        struct in_addr addr;
+        addr.s_addr = ip;
+        fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+                inet_ntoa(addr));
+      }
+    }
+  }
+  return false;
+}
+
+struct ReceiveContext {
+  HAL_PacketDesc *descs;
+  int n;
+  int count;
+  int port;
+};
+
+static void ReceiveCallback(u_char *user, const struct pcap_pkthdr *hdr,
+                            const u_char *packet) {
+  ReceiveContext *ctx = (ReceiveContext *)user;
+  if (ctx->count < ctx->n &&
+      HandleFrame(ctx->port, packet, hdr->caplen, &ctx->descs[ctx->count])) {
+    StatsCountRx(&counters, ctx->port, ctx->descs[ctx->count].length);
+    ctx->count++;
+  }
+}
+
+int HAL_ReceiveIPPackets(int if_index_mask, HAL_PacketDesc *descs, int n,
+                         int64_t timeout) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
   if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
-      (timeout < 0 && timeout != -1) || (if_index == NULL)) {
+      (timeout < 0 && timeout != -1) || (descs == NULL) || n <= 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
 
@@ -274,95 +447,158 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
-  // Round robin
-  int current_port = 0;
-  struct pcap_pkthdr hdr;
+  if (NeighborMaintainDue(&neighbors, begin)) {
+    NeighborRequest requests[NEIGHBOR_MAINTAIN_BURST];
+    int count;
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      count = NeighborMaintain(&neighbors, begin, requests);
+    }
+    for (int i = 0; i < count; i++) {
+      SendArpRequest(requests[i].if_index, requests[i].ip);
+    }
+  }
+  ReceiveContext ctx = {descs, n, 0, 0};
+  // Round robin, starting where the last call stopped
+  static int next_port = 0;
   do {
-    if ((if_index_mask & (1 << current_port)) == 0 ||
-        !pcap_in_handles[current_port]) {
-      current_port = (current_port + 1) % N_IFACE_ON_BOARD;
-      continue;
+    for (int i = 0; i < N_IFACE_ON_BOARD && ctx.count < n; i++) {
+      int current_port = (next_port + i) % N_IFACE_ON_BOARD;
+      if ((if_index_mask & (1 << current_port)) == 0 ||
+          !pcap_in_handles[current_port]) {
+        continue;
+      }
+      ctx.port = current_port;
+      pcap_dispatch(pcap_in_handles[current_port], n - ctx.count,
+                    ReceiveCallback, (u_char *)&ctx);
+    }
+    next_port = (next_port + 1) % N_IFACE_ON_BOARD;
+    if (ctx.count > 0) {
+      return ctx.count;
+    }
+    if (wake_pending.load(std::memory_order_relaxed) &&
+        wake_pending.exchange(false)) {
+      return 0;
     }
+    // -1 for infinity
+  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
+  return 0;
+}
 
-    const uint8_t *packet = pcap_next(pcap_in_handles[current_port], &hdr);
-    if (packet && hdr.caplen >= IP_OFFSET &&
-        memcmp(&packet[6], interface_mac[current_port], sizeof(macaddr_t)) ==
-            0) {
-      // skip outbound
-      continue;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x00) {
-      // IPv4
-      // TODO: what if len != caplen
-      size_t ip_len = hdr.caplen - IP_OFFSET;
-      size_t real_length = length > ip_len ? ip_len : length;
-      memcpy(buffer, &packet[IP_OFFSET], real_length);
-      memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
-      memcpy(src_mac, &packet[6], sizeof(macaddr_t));
-      *if_index = current_port;
-      return ip_len;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x06) {
-      // ARP
-      macaddr_t mac;
-      memcpy(mac, &packet[22], sizeof(macaddr_t));
-      in_addr_t ip;
-      memcpy(&ip, &packet[28], sizeof(in_addr_t));
-      memcpy(&arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
-             sizeof(macaddr_t));
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index == NULL) || (buffer == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  HAL_PacketDesc desc;
+  desc.buffer = buffer;
+  desc.size = length;
+  int res = HAL_ReceiveIPPackets(if_index_mask, &desc, 1, timeout);
+  if (res <= 0) {
+    return res;
+  }
+  memcpy(src_mac, desc.src_mac, sizeof(macaddr_t));
+  memcpy(dst_mac, desc.dst_mac, sizeof(macaddr_t));
+  *if_index = desc.if_index;
+  return desc.length;
+}
+
+static int FlushTxRing(int if_index) {
+  TxRing &ring = tx_rings[if_index];
+  int ret = 0;
+  for (int i = 0; i < ring.count; i++) {
+    if (pcap_inject(pcap_out_handles[if_index], ring.starts[i],
+                    ring.lengths[i]) < 0) {
       if (debugEnabled) {
-        struct in_addr addr;
-        addr.s_addr = ip;
-        fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
-                inet_ntoa(addr));
+        fprintf(stderr, "HAL_FlushIPPackets: pcap_inject failed with %s\n",
+                pcap_geterr(pcap_out_handles[if_index]));
       }
+      ret = HAL_ERR_UNKNOWN;
+    } else {
+      StatsCountTx(&counters, if_index, ring.lengths[i] - IP_OFFSET);
+    }
+    if (ring.owners[i] >= 0) {
+      FramePoolRelease(&frame_pool, ring.owners[i]);
+    }
+  }
+  ring.count = 0;
+  return ret;
+}
 
-      in_addr_t dst_ip;
-      memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
-      if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
-        // reply
-        uint8_t buffer[64] = {0};
-        // dst mac
-        memcpy(buffer, &packet[6], sizeof(macaddr_t));
-        // src mac
-        macaddr_t mac;
-        HAL_GetInterfaceMacAddress(current_port, mac);
-        memcpy(&buffer[6], mac, sizeof(macaddr_t));
-        // ARP
-        buffer[12] = 0x08;
-        buffer[13] = 0x06;
-        // hardware type
-        buffer[15] = 0x01;
-        // protocol type
-        buffer[16] = 0x08;
-        // hardware size
-        buffer[18] = 0x06;
-        // protocol size
-        buffer[19] = 0x04;
-        // opcode
-        buffer[21] = 0x02;
-        // sender
-        memcpy(&buffer[22], mac, sizeof(macaddr_t));
-        memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
-        // target
-        memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
-        memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
-
-        pcap_inject(pcap_out_handles[current_port], buffer, sizeof(buffer));
-        if (debugEnabled) {
-          struct in_addr addr;
-          addr.s_addr = ip;
-          fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
-                  inet_ntoa(addr));
-        }
+// queues a frame from HAL_ReceiveFrames, the Ethernet header goes into the
+// headroom of the pool buffer
+static void QueueFrame(int if_index, const HAL_Frame &frame,
+                       const uint8_t *eth_header) {
+  TxRing &ring = tx_rings[if_index];
+  if (ring.count == TX_RING_SIZE) {
+    FlushTxRing(if_index);
+  }
+  uint8_t *start = frame.data - IP_OFFSET;
+  memcpy(start, eth_header, IP_OFFSET);
+  ring.starts[ring.count] = start;
+  ring.lengths[ring.count] = frame.length + IP_OFFSET;
+  ring.owners[ring.count] = (int)frame.handle;
+  ring.count++;
+}
+
+int HAL_SendIPPackets(HAL_IN int if_index, HAL_IN HAL_PacketDesc *descs,
+                      HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || descs == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (!pcap_out_handles[if_index]) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  TxRing &ring = tx_rings[if_index];
+  for (int i = 0; i < n; i++) {
+    if (descs[i].length + IP_OFFSET > TX_FRAME_SIZE) {
+      // too large for a queue slot, send it on its own
+      int res = HAL_SendIPPacket(if_index, descs[i].buffer, descs[i].length,
+                                 descs[i].dst_mac);
+      if (res != 0) {
+        return i > 0 ? i : res;
       }
       continue;
     }
+    if (ring.count == TX_RING_SIZE) {
+      FlushTxRing(if_index);
+    }
+    uint8_t *frame = ring.frames[ring.count];
+    memcpy(frame, descs[i].dst_mac, sizeof(macaddr_t));
+    memcpy(&frame[6], interface_mac[if_index], sizeof(macaddr_t));
+    // IPv4
+    frame[12] = 0x08;
+    frame[13] = 0x00;
+    memcpy(&frame[IP_OFFSET], descs[i].buffer, descs[i].length);
+    ring.starts[ring.count] = frame;
+    ring.lengths[ring.count] = descs[i].length + IP_OFFSET;
+    ring.owners[ring.count] = -1;
+    ring.count++;
+  }
+  return n;
+}
 
-    current_port = (current_port + 1) % N_IFACE_ON_BOARD;
-    // -1 for infinity
-  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
-  return 0;
+int HAL_FlushIPPackets(HAL_IN int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < -1) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int ret = 0;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if ((if_index == -1 || if_index == i) && FlushTxRing(i) != 0) {
+      ret = HAL_ERR_UNKNOWN;
+    }
+  }
+  return ret;
 }
 
 int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer,
@@ -376,6 +612,8 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer,
   if (!pcap_out_handles[if_index]) {
     return HAL_ERR_IFACE_NOT_EXIST;
   }
+  // anything already queued goes out first
+  FlushTxRing(if_index);
   uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
   memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
   memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
@@ -386,6 +624,7 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer,
   if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + IP_OFFSET) >=
       0) {
     free(eth_buffer);
+    StatsCountTx(&counters, if_index, length);
     return 0;
   } else {
     if (debugEnabled) {
@@ -396,4 +635,157 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer,
     return HAL_ERR_UNKNOWN;
   }
 }
+
+int HAL_ReceiveFrames(HAL_IN int if_index_mask, HAL_OUT HAL_Frame *frames,
+                      HAL_IN int n, HAL_IN int64_t timeout) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  return FramePoolReceive(&frame_pool, if_index_mask, frames, n, timeout);
+}
+
+int HAL_SendFrames(HAL_IN int if_index, HAL_IN HAL_Frame *frames,
+                   HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 ||
+      !pcap_out_handles[if_index]) {
+    // the frames are ours either way
+    HAL_ReleaseFrames(frames, n);
+    return if_index >= N_IFACE_ON_BOARD || if_index < 0
+               ? HAL_ERR_INVALID_PARAMETER
+               : HAL_ERR_IFACE_NOT_EXIST;
+  }
+  for (int i = 0; i < n; i++) {
+    uint8_t header[IP_OFFSET];
+    memcpy(header, frames[i].dst_mac, sizeof(macaddr_t));
+    memcpy(&header[6], interface_mac[if_index], sizeof(macaddr_t));
+    // IPv4
+    header[12] = 0x08;
+    header[13] = 0x00;
+    QueueFrame(if_index, frames[i], header);
+  }
+  return n;
+}
+
+int HAL_SendFramesVia(HAL_IN HAL_Adjacency *adj, HAL_IN HAL_Frame *frames,
+                      HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int if_index = adj->if_index;
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 ||
+      !pcap_out_handles[if_index]) {
+    HAL_ReleaseFrames(frames, n);
+    return if_index >= N_IFACE_ON_BOARD || if_index < 0
+               ? HAL_ERR_INVALID_PARAMETER
+               : HAL_ERR_IFACE_NOT_EXIST;
+  }
+  uint8_t header[IP_OFFSET];
+  NeighborCopyAdjacency(adj, header);
+  for (int i = 0; i < n; i++) {
+    QueueFrame(if_index, frames[i], header);
+  }
+  return n;
+}
+
+int HAL_SendFramesToNeighbor(HAL_IN int if_index, HAL_IN in_addr_t ip,
+                             HAL_IN HAL_Frame *frames, HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 ||
+      !pcap_out_handles[if_index]) {
+    HAL_ReleaseFrames(frames, n);
+    return if_index >= N_IFACE_ON_BOARD || if_index < 0
+               ? HAL_ERR_INVALID_PARAMETER
+               : HAL_ERR_IFACE_NOT_EXIST;
+  }
+  macaddr_t mac;
+  uint64_t now = HAL_GetTicks();
+  // known neighbors are found without the lock
+  if (!NeighborMulticast(ip, mac) &&
+      !NeighborLookup(&neighbors, ip, if_index, now, mac)) {
+    bool request = false;
+    bool found;
+    int held = 0;
+    uint64_t dropped;
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      found = NeighborResolve(&neighbors, ip, if_index, now, mac, &request);
+      for (int i = 0; i < n && !found; i++) {
+        if (NeighborHold(&neighbors, ip, if_index, frames[i].data,
+                         frames[i].length, now, 0)) {
+          held++;
+        }
+      }
+      dropped = neighbors.hold_dropped[if_index];
+    }
+    if (request) {
+      SendArpRequest(if_index, ip);
+    }
+    if (debugEnabled && !found && held < n) {
+      struct in_addr addr;
+      addr.s_addr = ip;
+      fprintf(stderr,
+              "HAL_SendFramesToNeighbor: %d packets to %s dropped, %llu "
+              "in total\n",
+              n - held, inet_ntoa(addr), (unsigned long long)dropped);
+    }
+    if (!found) {
+      HAL_ReleaseFrames(frames, n);
+      return held;
+    }
+  }
+  uint8_t header[IP_OFFSET];
+  memcpy(header, mac, sizeof(macaddr_t));
+  memcpy(&header[6], interface_mac[if_index], sizeof(macaddr_t));
+  // IPv4
+  header[12] = 0x08;
+  header[13] = 0x00;
+  for (int i = 0; i < n; i++) {
+    QueueFrame(if_index, frames[i], header);
+  }
+  return n;
+}
+
+int HAL_AttachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || adj->if_index >= N_IFACE_ON_BOARD || adj->if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  NeighborAttach(&neighbors, adj, interface_mac[adj->if_index],
+                 HAL_GetTicks());
+  return 0;
+}
+
+void HAL_DetachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  if (!inited || adj == NULL) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  NeighborDetach(&neighbors, adj);
+}
+
+void HAL_ReleaseFrames(HAL_IN HAL_Frame *frames, HAL_IN int n) {
+  if (!inited || frames == NULL) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    FramePoolRelease(&frame_pool, frames[i].handle);
+  }
+}
 }
\ No newline at end of file
@@ -1,18 +1,25 @@
 #include "router_hal.h"
+#include "../common/frame_pool.h"
+#include "../common/neighbor_table.h"
+#include "../common/stats.h"
 #include <stdio.h>
 
-#include <map>
 #include <pcap.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <utility>
+#include <atomic>
+#ifdef HAL_STDIO_REPLAY
+#include <vector>
+#endif
 
 const int IP_OFFSET = 18; // 6 + 6 + 4 + 2
 
 bool inited = false;
 bool outputInited = false;
 int debugEnabled = 0;
+// see HAL_WakeWorker, checked before each frame is read
+std::atomic<bool> wake_pending(false);
 in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
 macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
 
@@ -22,13 +29,151 @@ pcap_t *pcap_handle;
 // output
 pcap_t *pcap_out_handle;
 pcap_dumper_t *pcap_dumper;
+// buffers behind HAL_ReceiveFrames
+FramePool frame_pool;
 
-// workaround for clang
-struct macaddr_wrap {
-  macaddr_t mac;
+NeighborTable neighbors;
+StatsTable counters;
+
+#ifdef HAL_STDIO_REPLAY
+// the input pcap read into memory at HAL_Init and handed out replay_loops
+// times over. Ticks are virtual: the capture time of the frame last handed
+// out, each loop continuing where the previous one ended.
+struct ReplayFrame {
+  struct pcap_pkthdr header;
+  std::vector<u_char> data;
 };
+std::vector<ReplayFrame> replay_frames;
+int replay_loops = 1;
+int replay_loop = 0;
+size_t replay_next = 0;
+uint64_t replay_ticks = 0;
+// capture time of the first frame and the length of one loop, in ms
+uint64_t replay_start = 0;
+uint64_t replay_span = 0;
+
+static uint64_t CaptureTicks(const struct pcap_pkthdr &header) {
+  return (uint64_t)header.ts.tv_sec * 1000 + header.ts.tv_usec / 1000;
+}
+
+static bool LoadReplay() {
+  struct pcap_pkthdr *hdr;
+  const u_char *packet;
+  int res;
+  while ((res = pcap_next_ex(pcap_handle, &hdr, &packet)) == 1) {
+    ReplayFrame frame;
+    frame.header = *hdr;
+    frame.data.assign(packet, packet + hdr->caplen);
+    // frames captured on a host have no VLAN tag, they arrive on port 0
+    if (hdr->caplen >= 14 && !(packet[12] == 0x81 && packet[13] == 0x00)) {
+      static const u_char tag[4] = {0x81, 0x00, 0x00, 0x00};
+      frame.data.insert(frame.data.begin() + 12, tag, tag + 4);
+      frame.header.caplen += 4;
+      frame.header.len += 4;
+    }
+    replay_frames.push_back(frame);
+  }
+  if (res != PCAP_ERROR_BREAK) {
+    return false;
+  }
+  if (!replay_frames.empty()) {
+    replay_start = CaptureTicks(replay_frames.front().header);
+    replay_span = CaptureTicks(replay_frames.back().header) - replay_start + 1;
+  }
+  return true;
+}
 
-std::map<std::pair<in_addr_t, int>, macaddr_wrap> arp_table;
+// replays the input loops times in all, 1 by default
+void StdioReplaySetLoops(int loops) { replay_loops = loops; }
+
+// frames handed out so far, over all loops
+uint64_t StdioReplayFrames() {
+  return (uint64_t)replay_loop * replay_frames.size() + replay_next;
+}
+#endif
+
+// the next input frame, returns like pcap_next_ex
+static int NextFrame(struct pcap_pkthdr **hdr, const u_char **packet) {
+#ifdef HAL_STDIO_REPLAY
+  if (replay_next == replay_frames.size()) {
+    if (replay_frames.empty() || replay_loop + 1 >= replay_loops) {
+      return PCAP_ERROR_BREAK;
+    }
+    replay_loop++;
+    replay_next = 0;
+  }
+  ReplayFrame &frame = replay_frames[replay_next++];
+  // never backwards, even if the capture is out of order
+  int64_t ticks = (int64_t)(CaptureTicks(frame.header) - replay_start) +
+                  (int64_t)(replay_loop * replay_span);
+  if (ticks > (int64_t)replay_ticks) {
+    replay_ticks = ticks;
+  }
+  *hdr = &frame.header;
+  *packet = frame.data.data();
+  return 1;
+#else
+  return pcap_next_ex(pcap_handle, hdr, packet);
+#endif
+}
+
+// broadcasts an ARP request for ip
+static void SendArpRequest(int if_index, in_addr_t ip) {
+  if (debugEnabled) {
+    struct in_addr addr;
+    addr.s_addr = ip;
+    fprintf(
+        stderr,
+        "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
+        inet_ntoa(addr));
+  }
+  uint8_t buffer[64] = {0};
+  // dst mac = broadcast
+  for (int i = 0; i < 6; i++) {
+    buffer[i] = 0xff;
+  }
+  // src mac
+  memcpy(&buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // 802.1Q
+  buffer[12] = 0x81;
+  buffer[13] = 0x00;
+  buffer[14] = 0x00;
+  buffer[15] = if_index;
+  // ARP
+  buffer[16] = 0x08;
+  buffer[17] = 0x06;
+  // hardware type
+  buffer[19] = 0x01;
+  // protocol type
+  buffer[20] = 0x08;
+  // hardware size
+  buffer[22] = 0x06;
+  // protocol size
+  buffer[23] = 0x04;
+  // opcode
+  buffer[25] = 0x01;
+  // sender
+  memcpy(&buffer[26], interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(&buffer[32], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  memcpy(&buffer[42], &ip, sizeof(in_addr_t));
+
+  struct pcap_pkthdr header;
+  header.caplen = header.len = sizeof(buffer);
+
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  header.ts.tv_sec = tp.tv_sec;
+  header.ts.tv_usec = tp.tv_nsec / 1000;
+
+  if (!outputInited) {
+    // output
+    pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
+    pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
+    outputInited = true;
+  }
+  pcap_dump((u_char *)pcap_dumper, &header, buffer);
+}
 
 extern "C" {
 int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
@@ -41,8 +186,8 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
     // hard coded MAC
     macaddr_t mac = {2, 3, 3, 0, 0, (uint8_t)i};
     memcpy(interface_mac[i], mac, sizeof(macaddr_t));
-    memcpy(&arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
-           interface_mac[i], sizeof(macaddr_t));
+    NeighborLearn(&neighbors, if_addrs[i], i, interface_mac[i], HAL_GetTicks(),
+                  true);
   }
 
   char error_buffer[PCAP_ERRBUF_SIZE];
@@ -58,14 +203,53 @@ int HAL_Init(HAL_IN int debug, HAL_IN in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
 
   memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
 
+#ifdef HAL_STDIO_REPLAY
+  if (!LoadReplay()) {
+    if (debugEnabled) {
+      fprintf(stderr, "pcap_next_ex failed with %s", pcap_geterr(pcap_handle));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+#endif
+
   inited = true;
   return 0;
 }
 
+int HAL_SetWorkerCount(int n) {
+  if (inited || n < 1 || n > HAL_MAX_WORKERS) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the output is one stream in a fixed order
+  return n == 1 ? 0 : HAL_ERR_NOT_SUPPORTED;
+}
+
+int HAL_BindWorker(int worker) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  return worker == 0 ? 0 : HAL_ERR_INVALID_PARAMETER;
+}
+
+int HAL_WakeWorker(int worker) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (worker != 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  wake_pending = true;
+  return 0;
+}
+
 uint64_t HAL_GetTicks() {
+#ifdef HAL_STDIO_REPLAY
+  return replay_ticks;
+#else
   struct timespec tp = {0};
   clock_gettime(CLOCK_MONOTONIC, &tp);
   return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+#endif
 }
 
 int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
@@ -82,68 +266,16 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
     return 0;
   }
 
-  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
-  if (it != arp_table.end()) {
-    memcpy(o_mac, &it->second, sizeof(macaddr_t));
-    return 0;
-  } else {
-    if (debugEnabled) {
-      struct in_addr addr;
-      addr.s_addr = ip;
-      fprintf(
-          stderr,
-          "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
-          inet_ntoa(addr));
+  // every miss is asked for, the output must not depend on timing
+  bool request = false;
+  {
+    std::lock_guard<std::mutex> lock(neighbors.lock);
+    if (NeighborResolve(&neighbors, ip, if_index, HAL_GetTicks(), o_mac,
+                        &request)) {
+      return 0;
     }
-    uint8_t buffer[64] = {0};
-    // dst mac = broadcast
-    for (int i = 0; i < 6; i++) {
-      buffer[i] = 0xff;
-    }
-    // src mac
-    macaddr_t mac;
-    HAL_GetInterfaceMacAddress(if_index, mac);
-    memcpy(&buffer[6], mac, sizeof(macaddr_t));
-    // 802.1Q
-    buffer[12] = 0x81;
-    buffer[13] = 0x00;
-    buffer[14] = 0x00;
-    buffer[15] = if_index;
-    // ARP
-    buffer[16] = 0x08;
-    buffer[17] = 0x06;
-    // hardware type
-    buffer[19] = 0x01;
-    // protocol type
-    buffer[20] = 0x08;
-    // hardware size
-    buffer[22] = 0x06;
-    // protocol size
-    buffer[23] = 0x04;
-    // opcode
-    buffer[25] = 0x01;
-    // sender
-    memcpy(&buffer[26], mac, sizeof(macaddr_t));
-    memcpy(&buffer[32], &interface_addrs[if_index], sizeof(in_addr_t));
-    // target
-    memcpy(&buffer[42], &ip, sizeof(in_addr_t));
-
-    struct pcap_pkthdr header;
-    header.caplen = header.len = sizeof(buffer);
-
-    struct timespec tp = {0};
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    header.ts.tv_sec = tp.tv_sec;
-    header.ts.tv_usec = tp.tv_nsec / 1000;
-
-    if (!outputInited) {
-      // output
-      pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-      pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-      outputInited = true;
-    }
-    pcap_dump((u_char *)pcap_dumper, &header, buffer);
   }
+  SendArpRequest(if_index, ip);
   return HAL_ERR_IP_NOT_EXIST;
 }
 
@@ -159,26 +291,55 @@ int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   return 0;
 }
 
-int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
-                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
-                        int *if_index) {
+int HAL_GetStats(HAL_IN int if_index, HAL_OUT HAL_Stats *stats) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || stats == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  StatsSum(&counters, if_index, stats);
+  // packets dropped while waiting for ARP are counted by the neighbor table
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  stats->drops[HAL_DROP_ARP_MISS] += neighbors.hold_dropped[if_index];
+  return 0;
+}
+
+void HAL_CountDrop(HAL_IN int if_index, HAL_IN int reason) {
+  StatsCountDrop(&counters, if_index, reason);
+}
+
+// NeighborSender for the packets held until their next hop was learned
+static void SendHeld(int if_index, const uint8_t *packet, size_t length,
+                     const macaddr_t mac) {
+  HAL_SendIPPacket(if_index, packet, length, mac);
+}
+
+int HAL_ReceiveIPPackets(int if_index_mask, HAL_PacketDesc *descs, int n,
+                         int64_t timeout) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
   if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
-      (timeout < 0 && timeout != -1) || (if_index == NULL)) {
+      (timeout < 0 && timeout != -1) || (descs == NULL) || n <= 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
 
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
+  int count = 0;
 
   struct pcap_pkthdr *hdr;
   const u_char *packet;
   do {
-    int res = pcap_next_ex(pcap_handle, &hdr, &packet);
+    if (count == 0 && wake_pending.load(std::memory_order_relaxed) &&
+        wake_pending.exchange(false)) {
+      return 0;
+    }
+    int res = NextFrame(&hdr, &packet);
     if (res == PCAP_ERROR_BREAK) {
-      return HAL_ERR_EOF;
+      // report EOF on the next call if this one already got something
+      return count > 0 ? count : HAL_ERR_EOF;
     } else if (res != 1) {
       // retry
       continue;
@@ -192,13 +353,19 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
       if (packet[16] == 0x08 && packet[17] == 0x00) {
         // IPv4
         // assuming len == caplen
+        HAL_PacketDesc *desc = &descs[count];
         size_t ip_len = hdr->caplen - IP_OFFSET;
-        size_t real_length = length > ip_len ? ip_len : length;
-        memcpy(buffer, &packet[IP_OFFSET], real_length);
-        memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
-        memcpy(src_mac, &packet[6], sizeof(macaddr_t));
-        *if_index = current_port;
-        return ip_len;
+        size_t real_length = desc->size > ip_len ? ip_len : desc->size;
+        memcpy(desc->buffer, &packet[IP_OFFSET], real_length);
+        memcpy(desc->dst_mac, &packet[0], sizeof(macaddr_t));
+        memcpy(desc->src_mac, &packet[6], sizeof(macaddr_t));
+        desc->length = ip_len;
+        desc->if_index = current_port;
+        StatsCountRx(&counters, current_port, ip_len);
+        if (++count == n) {
+          return count;
+        }
+        continue;
       } else if (packet[16] == 0x08 && packet[17] == 0x06) {
         // ARP
         macaddr_t mac;
@@ -206,8 +373,12 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
         in_addr_t ip;
         memcpy(&ip, &packet[32], sizeof(in_addr_t));
 
-        memcpy(&arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
-               sizeof(macaddr_t));
+        {
+          std::lock_guard<std::mutex> lock(neighbors.lock);
+          NeighborLearn(&neighbors, ip, current_port, mac, HAL_GetTicks(),
+                        false);
+        }
+        NeighborSendReleased(&neighbors, 0, SendHeld);
         if (debugEnabled) {
           struct in_addr addr;
           addr.s_addr = ip;
@@ -280,18 +451,35 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 
     // -1 for infinity
   } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
-  return 0;
+  return count;
 }
 
-int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t length,
-                     HAL_IN macaddr_t dst_mac) {
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+  if ((if_index == NULL) || (buffer == NULL)) {
     return HAL_ERR_INVALID_PARAMETER;
   }
-  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  HAL_PacketDesc desc;
+  desc.buffer = buffer;
+  desc.size = length;
+  int res = HAL_ReceiveIPPackets(if_index_mask, &desc, 1, timeout);
+  if (res <= 0) {
+    return res;
+  }
+  memcpy(src_mac, desc.src_mac, sizeof(macaddr_t));
+  memcpy(dst_mac, desc.dst_mac, sizeof(macaddr_t));
+  *if_index = desc.if_index;
+  return desc.length;
+}
+
+// writes the frame header into the IP_OFFSET bytes in front of the packet and
+// dumps the whole frame
+static void DumpFrame(uint8_t *eth_buffer, int if_index, size_t length,
+                      const macaddr_t dst_mac) {
   memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
   memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
   // VLAN
@@ -302,7 +490,6 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t
   // IPv4
   eth_buffer[16] = 0x08;
   eth_buffer[17] = 0x00;
-  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
   struct pcap_pkthdr header;
   header.caplen = header.len = length + IP_OFFSET;
 
@@ -318,7 +505,180 @@ int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t
     outputInited = true;
   }
   pcap_dump((u_char *)pcap_dumper, &header, eth_buffer);
+  StatsCountTx(&counters, if_index, length);
+}
+
+int HAL_SendIPPacket(HAL_IN int if_index, HAL_IN uint8_t *buffer, HAL_IN size_t length,
+                     HAL_IN macaddr_t dst_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
+  DumpFrame(eth_buffer, if_index, length, dst_mac);
   free(eth_buffer);
   return 0;
 }
+
+int HAL_SendIPPackets(HAL_IN int if_index, HAL_IN HAL_PacketDesc *descs,
+                      HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || descs == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // pcap_dump already writes through a stdio buffer, which is our queue
+  for (int i = 0; i < n; i++) {
+    HAL_SendIPPacket(if_index, descs[i].buffer, descs[i].length,
+                     descs[i].dst_mac);
+  }
+  return n;
+}
+
+int HAL_FlushIPPackets(HAL_IN int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < -1) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (outputInited) {
+    pcap_dump_flush(pcap_dumper);
+  }
+  return 0;
+}
+
+int HAL_ReceiveFrames(HAL_IN int if_index_mask, HAL_OUT HAL_Frame *frames,
+                      HAL_IN int n, HAL_IN int64_t timeout) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  return FramePoolReceive(&frame_pool, if_index_mask, frames, n, timeout);
+}
+
+int HAL_SendFrames(HAL_IN int if_index, HAL_IN HAL_Frame *frames,
+                   HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    HAL_ReleaseFrames(frames, n);
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the VLAN header fits into the headroom of the pool buffer
+  for (int i = 0; i < n; i++) {
+    DumpFrame(frames[i].data - IP_OFFSET, if_index, frames[i].length,
+              frames[i].dst_mac);
+    FramePoolRelease(&frame_pool, frames[i].handle);
+  }
+  return n;
+}
+
+int HAL_SendFramesVia(HAL_IN HAL_Adjacency *adj, HAL_IN HAL_Frame *frames,
+                      HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (adj->if_index >= N_IFACE_ON_BOARD || adj->if_index < 0) {
+    HAL_ReleaseFrames(frames, n);
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the VLAN tag goes in between, so only the destination is taken from the
+  // prebuilt header
+  uint8_t header[14];
+  NeighborCopyAdjacency(adj, header);
+  for (int i = 0; i < n; i++) {
+    DumpFrame(frames[i].data - IP_OFFSET, adj->if_index, frames[i].length,
+              header);
+    FramePoolRelease(&frame_pool, frames[i].handle);
+  }
+  return n;
+}
+
+int HAL_SendFramesToNeighbor(HAL_IN int if_index, HAL_IN in_addr_t ip,
+                             HAL_IN HAL_Frame *frames, HAL_IN int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    HAL_ReleaseFrames(frames, n);
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  macaddr_t mac;
+  uint64_t now = HAL_GetTicks();
+  // known neighbors are found without the lock
+  if (!NeighborMulticast(ip, mac) &&
+      !NeighborLookup(&neighbors, ip, if_index, now, mac)) {
+    bool request = false;
+    bool found;
+    int held = 0;
+    {
+      std::lock_guard<std::mutex> lock(neighbors.lock);
+      found = NeighborResolve(&neighbors, ip, if_index, now, mac, &request);
+      for (int i = 0; i < n && !found; i++) {
+        if (NeighborHold(&neighbors, ip, if_index, frames[i].data,
+                         frames[i].length, now, 0)) {
+          held++;
+        }
+      }
+    }
+    if (!found) {
+      // asked for on every miss, like HAL_ArpGetMacAddress
+      SendArpRequest(if_index, ip);
+      HAL_ReleaseFrames(frames, n);
+      return held;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    DumpFrame(frames[i].data - IP_OFFSET, if_index, frames[i].length, mac);
+    FramePoolRelease(&frame_pool, frames[i].handle);
+  }
+  return n;
+}
+
+// adjacencies are not resolved ahead of time, they are filled in when a
+// forwarded packet misses and its ARP reply is read, so that the output does
+// not depend on timing either
+int HAL_AttachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || adj->if_index >= N_IFACE_ON_BOARD || adj->if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  NeighborAttach(&neighbors, adj, interface_mac[adj->if_index],
+                 HAL_GetTicks());
+  return 0;
+}
+
+void HAL_DetachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  if (!inited || adj == NULL) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(neighbors.lock);
+  NeighborDetach(&neighbors, adj);
+}
+
+void HAL_ReleaseFrames(HAL_IN HAL_Frame *frames, HAL_IN int n) {
+  if (!inited || frames == NULL) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    FramePoolRelease(&frame_pool, frames[i].handle);
+  }
+}
 }
@@ -11,6 +11,9 @@ const int ARP_LENGTH = 28;
 
 int inited = 0;
 int debugEnabled = 0;
+// see HAL_WakeWorker, one core: only an interrupt handler can set it while
+// the receive loop runs
+volatile int wakePending = 0;
 in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
 macaddr_t interface_mac = {2, 3, 3, 3, 3, 3};
 
@@ -48,6 +51,12 @@ struct EthernetFrame rxBuffers[BD_COUNT] __attribute__((section(".physical")));
 struct EthernetFrame txBuffers[BD_COUNT] __attribute__((section(".physical")));
 u32 txBufferUsed = 0;
 
+// buffers behind HAL_ReceiveFrames, the DMA buffers are recycled right away
+#define FRAME_COUNT 16
+#define FRAME_MTU 1500
+u8 frameBuffers[FRAME_COUNT][HAL_FRAME_HEADROOM + FRAME_MTU];
+int frameUsed[FRAME_COUNT] = {0};
+
 #define ARP_TABLE_SIZE 16
 
 // simple FIFO cache
@@ -57,6 +66,45 @@ struct ArpTableEntry {
   in_addr_t ip;
 } arpTable[ARP_TABLE_SIZE];
 
+// attached by the caller, patched whenever their neighbor is learned
+HAL_Adjacency *adjacencies = NULL;
+
+// frames waiting for an ARP reply, they keep their frame buffer until then
+#define HOLD_COUNT 4
+#define HOLD_TIME 3000
+struct HeldFrame {
+  int used;
+  int if_index;
+  in_addr_t ip;
+  uint64_t handle;
+  size_t length;
+  uint64_t since;
+} heldFrames[HOLD_COUNT];
+// frames that could not be held or whose neighbor never answered
+u32 holdDropped = 0;
+
+void UpdateAdjacencies(int if_index, in_addr_t ip, const macaddr_t mac) {
+  for (HAL_Adjacency *adj = adjacencies; adj != NULL; adj = adj->next) {
+    if (adj->if_index == if_index && adj->ip == ip) {
+      memcpy(adj->header, mac, sizeof(macaddr_t));
+      adj->valid = 1;
+    }
+  }
+}
+
+void SendHeldFrames(int if_index, in_addr_t ip, macaddr_t mac) {
+  for (int i = 0; i < HOLD_COUNT; i++) {
+    struct HeldFrame *held = &heldFrames[i];
+    if (held->used && held->if_index == if_index && held->ip == ip) {
+      HAL_SendIPPacket(if_index,
+                       &frameBuffers[held->handle][HAL_FRAME_HEADROOM],
+                       held->length, mac);
+      frameUsed[held->handle] = 0;
+      held->used = 0;
+    }
+  }
+}
+
 void SpiWriteRegister(u8 addr, u8 data) {
   u8 writeBuffer[3];
   // write
@@ -184,6 +232,32 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   return 0;
 }
 
+int HAL_SetWorkerCount(int n) {
+  if (inited || n < 1 || n > HAL_MAX_WORKERS) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // one core
+  return n == 1 ? 0 : HAL_ERR_NOT_SUPPORTED;
+}
+
+int HAL_BindWorker(int worker) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  return worker == 0 ? 0 : HAL_ERR_INVALID_PARAMETER;
+}
+
+int HAL_WakeWorker(int worker) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (worker != 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  wakePending = 1;
+  return 0;
+}
+
 uint64_t HAL_GetTicks() {
   // TODO
   return XTmrCtr_GetValue(&tmrCtr, 0) * 1000 / XPAR_AXI_TIMER_0_CLOCK_FREQ_HZ;
@@ -279,6 +353,16 @@ int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   return 0;
 }
 
+int HAL_GetStats(int if_index, HAL_Stats *stats) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  // no counters kept on the board
+  return HAL_ERR_NOT_SUPPORTED;
+}
+
+void HAL_CountDrop(int if_index, int reason) {}
+
 int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
                         macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
                         int *if_index) {
@@ -295,6 +379,10 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   uint64_t begin = HAL_GetTicks();
   uint64_t current_time = 0;
   while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1) {
+    if (wakePending) {
+      wakePending = 0;
+      return 0;
+    }
     if (XAxiDma_BdRingFromHw(rxRing, 1, &bd) == 1) {
       // See AXI Ethernet Table 3-15
       u32 length = XAxiDma_BdRead(bd, XAXIDMA_BD_USR4_OFFSET) & 0xFFFF;
@@ -332,6 +420,9 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
           }
         }
 
+        UpdateAdjacencies(vlan, ip, mac);
+        SendHeldFrames(vlan, ip, mac);
+
         if (insert) {
           memmove(&arpTable[1], arpTable,
                   (ARP_TABLE_SIZE - 1) * sizeof(struct ArpTableEntry));
@@ -413,6 +504,23 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   return 0;
 }
 
+int HAL_ReceiveIPPackets(int if_index_mask, HAL_PacketDesc *descs, int n,
+                         int64_t timeout) {
+  if (descs == NULL || n <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the DMA ring is polled one descriptor at a time, bursts hold one packet
+  HAL_PacketDesc *desc = &descs[0];
+  int res = HAL_ReceiveIPPacket(if_index_mask, desc->buffer, desc->size,
+                                desc->src_mac, desc->dst_mac, timeout,
+                                &desc->if_index);
+  if (res <= 0) {
+    return res;
+  }
+  desc->length = res;
+  return 1;
+}
+
 int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
                      macaddr_t dst_mac) {
   if (!inited) {
@@ -448,3 +556,200 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   XAxiDma_BdRingToHw(txRing, 1, bd);
   return 0;
 }
+
+int HAL_SendIPPackets(int if_index, HAL_PacketDesc *descs, int n) {
+  if (descs == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // every packet is handed to the DMA ring as soon as it is queued
+  for (int i = 0; i < n; i++) {
+    int res = HAL_SendIPPacket(if_index, descs[i].buffer, descs[i].length,
+                               descs[i].dst_mac);
+    if (res != 0) {
+      return i > 0 ? i : res;
+    }
+  }
+  return n;
+}
+
+int HAL_FlushIPPackets(int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < -1) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  return 0;
+}
+
+int HAL_ReceiveFrames(int if_index_mask, HAL_Frame *frames, int n,
+                      int64_t timeout) {
+  if (frames == NULL || n <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int index = -1;
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    if (!frameUsed[i]) {
+      index = i;
+      break;
+    }
+  }
+  if (index < 0) {
+    // the caller holds every buffer
+    return HAL_ERR_UNKNOWN;
+  }
+  // one packet per call, copied out of the DMA buffer
+  HAL_Frame *frame = &frames[0];
+  frame->data = &frameBuffers[index][HAL_FRAME_HEADROOM];
+  int res = HAL_ReceiveIPPacket(if_index_mask, frame->data, FRAME_MTU,
+                                frame->src_mac, frame->dst_mac, timeout,
+                                &frame->if_index);
+  if (res <= 0) {
+    return res;
+  }
+  if (res > FRAME_MTU) {
+    // truncated
+    return 0;
+  }
+  frameUsed[index] = 1;
+  frame->length = res;
+  frame->handle = index;
+  return 1;
+}
+
+int HAL_SendFrames(int if_index, HAL_Frame *frames, int n) {
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the DMA engine needs its own buffers, so every frame is copied
+  int sent = 0;
+  for (int i = 0; i < n; i++) {
+    if (HAL_SendIPPacket(if_index, frames[i].data, frames[i].length,
+                         frames[i].dst_mac) == 0) {
+      sent++;
+    }
+  }
+  HAL_ReleaseFrames(frames, n);
+  return sent;
+}
+
+int HAL_SendFramesVia(HAL_Adjacency *adj, HAL_Frame *frames, int n) {
+  if (adj == NULL || frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // the VLAN tag goes in between, so only the destination is taken from the
+  // prebuilt header
+  int sent = 0;
+  for (int i = 0; i < n; i++) {
+    if (HAL_SendIPPacket(adj->if_index, frames[i].data, frames[i].length,
+                         adj->header) == 0) {
+      sent++;
+    }
+  }
+  HAL_ReleaseFrames(frames, n);
+  return sent;
+}
+
+int HAL_SendFramesToNeighbor(int if_index, in_addr_t ip, HAL_Frame *frames,
+                             int n) {
+  if (frames == NULL || n < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    HAL_ReleaseFrames(frames, n);
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  macaddr_t mac;
+  if (HAL_ArpGetMacAddress(if_index, ip, mac) == 0) {
+    int sent = 0;
+    for (int i = 0; i < n; i++) {
+      if (HAL_SendIPPacket(if_index, frames[i].data, frames[i].length, mac) ==
+          0) {
+        sent++;
+      }
+    }
+    HAL_ReleaseFrames(frames, n);
+    return sent;
+  }
+
+  // the ARP request is out, hold on to the frames until the reply
+  uint64_t now = HAL_GetTicks();
+  int held = 0;
+  for (int i = 0; i < n; i++) {
+    int slot = -1;
+    for (int j = 0; j < HOLD_COUNT; j++) {
+      if (heldFrames[j].used && heldFrames[j].since + HOLD_TIME < now) {
+        frameUsed[heldFrames[j].handle] = 0;
+        heldFrames[j].used = 0;
+        holdDropped++;
+      }
+      if (!heldFrames[j].used && slot < 0) {
+        slot = j;
+      }
+    }
+    if (slot < 0 || frames[i].handle >= FRAME_COUNT) {
+      holdDropped++;
+      HAL_ReleaseFrames(&frames[i], 1);
+      continue;
+    }
+    heldFrames[slot].used = 1;
+    heldFrames[slot].if_index = if_index;
+    heldFrames[slot].ip = ip;
+    heldFrames[slot].handle = frames[i].handle;
+    heldFrames[slot].length = frames[i].length;
+    heldFrames[slot].since = now;
+    held++;
+  }
+  return held;
+}
+
+int HAL_AttachAdjacency(HAL_Adjacency *adj) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (adj == NULL || adj->if_index >= N_IFACE_ON_BOARD || adj->if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  memset(adj->header, 0, sizeof(macaddr_t));
+  memcpy(&adj->header[6], interface_mac, sizeof(macaddr_t));
+  // IPv4
+  adj->header[12] = 0x08;
+  adj->header[13] = 0x00;
+  adj->valid = 0;
+  for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+    if (arpTable[i].if_index == adj->if_index && arpTable[i].ip == adj->ip) {
+      memcpy(adj->header, arpTable[i].mac, sizeof(macaddr_t));
+      adj->valid = 1;
+      break;
+    }
+  }
+  // unresolved ones are asked for by the first packet that misses
+  adj->next = adjacencies;
+  adjacencies = adj;
+  return 0;
+}
+
+void HAL_DetachAdjacency(HAL_Adjacency *adj) {
+  if (adj == NULL) {
+    return;
+  }
+  for (HAL_Adjacency **link = &adjacencies; *link != NULL;
+       link = &(*link)->next) {
+    if (*link == adj) {
+      *link = adj->next;
+      break;
+    }
+  }
+  adj->valid = 0;
+}
+
+void HAL_ReleaseFrames(HAL_Frame *frames, int n) {
+  if (frames == NULL) {
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    if (frames[i].handle < FRAME_COUNT) {
+      frameUsed[frames[i].handle] = 0;
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#include "adjacency.h"
+
+AdjacencyTable::AdjacencyTable() {
+  // never reallocated, see above
+  table.reserve(CAPACITY);
+  Adjacency none = {};
+  table.push_back(none);
+}
+
+uint16_t AdjacencyTable::acquire(uint32_t nexthop, uint32_t if_index) {
+  uint64_t key = pairKey(nexthop, if_index);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    table[it->second].refs++;
+    return it->second;
+  }
+
+  uint16_t adj;
+  if (!freeList.empty()) {
+    adj = freeList.back();
+    freeList.pop_back();
+  } else if (table.size() < CAPACITY) {
+    adj = table.size();
+    table.resize(adj + 1);
+  } else {
+    return NONE;
+  }
+  Adjacency &a = table[adj];
+  a.nexthop = nexthop;
+  a.if_index = if_index;
+  a.refs = 1;
+  a.link.if_index = if_index;
+  a.link.ip = nexthop;
+  a.link.valid = 0;
+  // resolved in the background, packets go the slow way until then
+  if (nexthop != 0) HAL_AttachAdjacency(&a.link);
+  index[key] = adj;
+  return adj;
+}
+
+void AdjacencyTable::release(uint16_t adj) {
+  if (adj == NONE) return;
+  Adjacency &a = table[adj];
+  if (--a.refs == 0) {
+    if (a.nexthop != 0) HAL_DetachAdjacency(&a.link);
+    index.erase(pairKey(a.nexthop, a.if_index));
+    freeList.push_back(adj);
+  }
+}
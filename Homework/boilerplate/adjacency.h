@@ -0,0 +1,56 @@
+#ifndef __ADJACENCY_H__
+#define __ADJACENCY_H__
+
+#include "router_hal.h"
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+typedef struct {
+  uint32_t nexthop;
+  uint32_t if_index;
+  uint32_t refs;
+  // Ethernet header towards the next hop, kept up to date by the HAL; not
+  // attached for directly connected routes (nexthop 0), whose packets are
+  // resolved per destination
+  HAL_Adjacency link;
+} Adjacency;
+
+// true if packets can be sent with the prebuilt header of adj
+static inline bool adjacencyResolved(const Adjacency &adj) {
+  return adj.nexthop != 0 && __atomic_load_n(&adj.link.valid, __ATOMIC_ACQUIRE);
+}
+
+// Interns (nexthop, if_index) pairs so that forwarding tables store 16-bit
+// indices instead of full routes. Index 0 is reserved for "no route", and
+// indices stay below 0x8000 so engines can use the top bit as a flag.
+// Entries never move, as the HAL holds on to their links.
+class AdjacencyTable {
+public:
+  static const uint16_t NONE = 0;
+  static const uint32_t CAPACITY = 0x8000;
+
+  AdjacencyTable();
+
+  // returns the index for the pair and takes a reference, NONE if full
+  uint16_t acquire(uint32_t nexthop, uint32_t if_index);
+  void release(uint16_t adj);
+  // returns the index for the pair without taking a reference
+  uint16_t find(uint32_t nexthop, uint32_t if_index) const {
+    auto it = index.find(pairKey(nexthop, if_index));
+    return it == index.end() ? NONE : it->second;
+  }
+
+  const Adjacency &get(uint16_t adj) const { return table[adj]; }
+
+private:
+  static uint64_t pairKey(uint32_t nexthop, uint32_t if_index) {
+    return ((uint64_t)if_index << 32) | nexthop;
+  }
+
+  std::vector<Adjacency> table;
+  std::vector<uint16_t> freeList;
+  std::unordered_map<uint64_t, uint16_t> index;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "datapath.h"
+#include "logger.h"
+#include "router.h"
+#include "router_hal.h"
+#include "timer_wheel.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <chrono>
+
+// Forwarding throughput on a replayed pcap, with the stdio backend built with
+// HAL_STDIO_REPLAY:
+//
+//   ./router_bench 100 < ../../host0.pcap > /dev/null
+//
+// runs the capture 100 times through the router's own processFrame and
+// handleRip, and reports to stderr. One thread plays both parts: each burst
+// is received and processed as a forwarding worker does, then the packets it
+// queued for the control thread are handled as the control thread does,
+// right away instead of after a wakeup. Ticks follow the capture, so routes
+// learned from its RIP responses time out as they would have. Each stage is
+// timed once per burst, which keeps the clock reads out of the per-packet
+// cost. The RIP responses in the capture are logged as in the router; build
+// with -DLOG_LEVEL=LOG_LEVEL_WARN to leave that out of the control stage.
+
+extern void update(bool insert, RoutingTableEntry entry);
+extern void beginUpdate();
+extern void commitUpdate();
+extern void StdioReplaySetLoops(int loops);
+extern uint64_t StdioReplayFrames();
+
+#define RX_BURST 32
+
+in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0203a8c0, 0x0104a8c0, 0x0100000a, 0x0101000a};
+in_addr_t multicast_addr = {0x090000e0};
+
+// route timeouts in the RIB; no updates are sent, so nothing is triggered
+TimerWheel timers;
+void scheduleTriggeredUpdate() {}
+
+// packets for the control thread, emptied after every burst
+ControlRing control;
+
+enum Stage { RECEIVE, PROCESS, FLUSH, CONTROL, STAGES };
+const char *stageNames[STAGES] = {"receive", "process", "flush", "control"};
+uint64_t stageNs[STAGES];
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[]) {
+  int loops = argc > 1 ? atoi(argv[1]) : 1;
+  if (loops < 1) loops = 1;
+  StdioReplaySetLoops(loops);
+  int res = HAL_Init(0, addrs);
+  if (res < 0) {
+    fprintf(stderr, "HAL_Init failed with %d, is the HAL built with HAL_STDIO_REPLAY?\n", res);
+    return res;
+  }
+  // as in the router, so that handleRip logs through the ring
+  logStart();
+  timers.advance(HAL_GetTicks());
+  for (uint32_t i = 0; i < N_IFACE_ON_BOARD; i++) {
+    RoutingTableEntry entry = {
+        .addr = addrs[i] & 0x00ffffff,
+        .len = 24,
+        .if_index = i,
+        .nexthop = 0,
+        .metric = 1
+    };
+    update(true, entry);
+  }
+
+  uint64_t packets = 0, local = 0;
+  HAL_Frame frames[RX_BURST];
+  uint64_t begin = nowNs();
+  while (true) {
+    uint64_t t0 = nowNs();
+    int count = HAL_ReceiveFrames((1 << N_IFACE_ON_BOARD) - 1, frames, RX_BURST, -1);
+    if (count == HAL_ERR_EOF) break;
+    if (count < 0) {
+      fprintf(stderr, "HAL_ReceiveFrames failed with %d\n", count);
+      return count;
+    }
+    packets += count;
+    uint64_t t1 = nowNs();
+
+    // the forwarding worker: every frame is sent, dropped or queued
+    for (int i = 0; i < count; i++)
+      local += processFrame(frames[i], control);
+    uint64_t t2 = nowNs();
+
+    HAL_FlushIPPackets(-1);
+    uint64_t t3 = nowNs();
+
+    // the control thread: due route timers, then the queued RIP packets
+    beginUpdate();
+    timers.advance(HAL_GetTicks());
+    commitUpdate();
+    for (ControlPacket *in; (in = control.front()) != NULL; control.pop())
+      handleRip(in->data, in->length, in->if_index);
+    uint64_t t4 = nowNs();
+
+    stageNs[RECEIVE] += t1 - t0;
+    stageNs[PROCESS] += t2 - t1;
+    stageNs[FLUSH] += t3 - t2;
+    stageNs[CONTROL] += t4 - t3;
+  }
+  uint64_t elapsed = nowNs() - begin;
+  logStop();
+
+  // sent and dropped as counted by the HAL, including what processFrame
+  // dropped
+  uint64_t sent = 0, dropped = 0;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    HAL_Stats stats;
+    if (HAL_GetStats(i, &stats) != 0) continue;
+    sent += stats.tx_packets;
+    for (int j = 0; j < HAL_DROP_REASONS; j++)
+      dropped += stats.drops[j];
+  }
+
+  fprintf(stderr, "%d loops, %llu frames, %llu IPv4 packets: %llu sent, %llu local, %llu dropped\n",
+          loops, (unsigned long long)StdioReplayFrames(), (unsigned long long)packets,
+          (unsigned long long)sent, (unsigned long long)local, (unsigned long long)dropped);
+  if (packets == 0) return 0;
+  fprintf(stderr, "%.3f s, %.0f packets/s, %.1f ns/packet\n", elapsed / 1e9,
+          packets * 1e9 / elapsed, (double)elapsed / packets);
+  for (int i = 0; i < STAGES; i++)
+    fprintf(stderr, "  %-8s %8.1f ns/packet %5.1f%%\n", stageNames[i],
+            (double)stageNs[i] / packets, stageNs[i] * 100.0 / elapsed);
+  return 0;
+}
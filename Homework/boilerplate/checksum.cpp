@@ -1,27 +1,117 @@
+#include "checksum.h"
+#include <arpa/inet.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include<stdio.h>
-
-unsigned int addWhileC(unsigned int a, unsigned int b){
-  int res = a+b;
-  while(res  >= 65536)
-    res = (res & 0xFFFF) + (res >> 16);
-  return res;
-}
-
-bool validateIPChecksum(uint8_t *packet, size_t len) {
-  int head_length = (packet[0] % 16)  * 4;
-  unsigned int sum = (packet[10] << 8) + packet[11];
-  unsigned int predict_sum = 0;
-  auto phi = packet[10];
-  auto plo = packet[11];
-  packet[10] = 0;
-  packet[11] = 0;
-  for(int i = 0 ; i < head_length/2 ; i++){
-    predict_sum = addWhileC(predict_sum, (unsigned)(packet[i*2] << 8)+packet[2*i+1]);
-    }
-  predict_sum = (~predict_sum) & 0xFFFF;
-  packet[10] = phi;
-  packet[11] = plo;
-  return predict_sum == sum;
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+// The kernels add the buffer as native-order words with end-around carry,
+// which yields the byte-swapped checksum on little-endian hosts (RFC 1071,
+// byte order independence); checksumAdd swaps it back once at the end.
+typedef uint64_t (*SumKernel)(const uint8_t *data, size_t len);
+
+static uint64_t addCarry(uint64_t a, uint64_t b) {
+  uint64_t sum = a + b;
+  return sum + (sum < b);
+}
+
+static uint64_t sumScalar(const uint8_t *data, size_t len) {
+  uint64_t sum = 0;
+  for (; len >= 8; data += 8, len -= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    sum = addCarry(sum, word);
+  }
+  // the remaining bytes keep their place in the word, an odd one is padded
+  uint64_t tail = 0;
+  memcpy(&tail, data, len);
+  return addCarry(sum, tail);
+}
+
+#ifdef CHECKSUM_X86
+// 32-bit words are widened into 64-bit lanes, which cannot overflow
+__attribute__((target("sse2"))) static uint64_t sumSse2(const uint8_t *data,
+                                                        size_t len) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  for (; len >= 16; data += 16, len -= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)data);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return addCarry(addCarry(lanes[0], lanes[1]), sumScalar(data, len));
+}
+
+__attribute__((target("avx2"))) static uint64_t sumAvx2(const uint8_t *data,
+                                                        size_t len) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  for (; len >= 32; data += 32, len -= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)data);
+    acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+    acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  uint64_t sum = addCarry(addCarry(lanes[0], lanes[1]),
+                          addCarry(lanes[2], lanes[3]));
+  return addCarry(sum, sumScalar(data, len));
+}
+#endif
+
+static SumKernel selectKernel() {
+#ifdef CHECKSUM_X86
+  // cpuid, also checks that the OS saves the AVX state
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return sumAvx2;
+  if (__builtin_cpu_supports("sse2")) return sumSse2;
+#endif
+  return sumScalar;
+}
+
+static const SumKernel sumKernel = selectKernel();
+
+uint32_t checksumAdd(uint32_t sum, const uint8_t *data, size_t len) {
+  uint64_t wide = sumKernel(data, len);
+  wide = (wide & 0xFFFFFFFF) + (wide >> 32);
+  wide = (wide & 0xFFFFFFFF) + (wide >> 32);
+  uint32_t folded = (uint32_t)((wide & 0xFFFF) + (wide >> 16));
+  folded = (folded & 0xFFFF) + (folded >> 16);
+  return sum + ntohs((uint16_t)folded);
+}
+
+uint16_t checksumFinish(uint32_t sum) {
+  while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  return (~sum) & 0xFFFF;
+}
+
+uint16_t internetChecksum(const uint8_t *data, size_t len) {
+  return checksumFinish(checksumAdd(0, data, len));
+}
+
+bool validateIPChecksum(const uint8_t *packet, size_t len) {
+  size_t head_length = (packet[0] % 16) * 4;
+  if (head_length < 20 || head_length > len) return false;
+  // summed over its own checksum, a valid header comes out as zero
+  return internetChecksum(packet, head_length) == 0;
+}
+
+uint16_t udpChecksum(const uint8_t *packet, size_t len) {
+  size_t head_length = (packet[0] % 16) * 4;
+  size_t udp_len = (packet[head_length + 4] << 8) + packet[head_length + 5];
+  if (head_length + udp_len > len) udp_len = len - head_length;
+  if (udp_len < 8) return 0xFFFF;
+  // pseudo header: addresses, protocol and UDP length
+  uint32_t sum = checksumAdd(packet[9] + udp_len, &packet[12], 8);
+  // the header without its checksum field, then the payload
+  sum = checksumAdd(sum, &packet[head_length], 6);
+  sum = checksumAdd(sum, &packet[head_length + 8], udp_len - 8);
+  uint16_t checksum = checksumFinish(sum);
+  return checksum == 0 ? 0xFFFF : checksum;
 }
@@ -0,0 +1,23 @@
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Internet checksum (RFC 1071). Sums are of big-endian 16-bit words and are
+// returned in host byte order; buffers are never modified. The widest kernel
+// the CPU supports (AVX2, SSE2 or plain 64-bit) is picked at startup.
+
+// adds len bytes to a running sum that may also hold plain values such as
+// pseudo header fields; only the last buffer added may have an odd length
+uint32_t checksumAdd(uint32_t sum, const uint8_t *data, size_t len);
+// folds a running sum into the value that goes into a checksum field
+uint16_t checksumFinish(uint32_t sum);
+uint16_t internetChecksum(const uint8_t *data, size_t len);
+
+// checks the header checksum of an IPv4 packet, options included
+bool validateIPChecksum(const uint8_t *packet, size_t len);
+// checksum for the UDP datagram in an IPv4 packet, never 0 (RFC 768)
+uint16_t udpChecksum(const uint8_t *packet, size_t len);
+
+#endif
@@ -0,0 +1,133 @@
+#include "adjacency.h"
+#include "checksum.h"
+#include "datapath.h"
+#include "logger.h"
+#include "rcu.h"
+#include "rip.h"
+#include "router.h"
+#include "router_hal.h"
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+extern const Adjacency *queryAdjacency(uint32_t addr);
+extern void decrementTTL(uint8_t *packet);
+extern void update(RoutingTableEntry entry);
+extern void beginUpdate();
+extern void commitUpdate();
+
+// data path: never blocks on the control thread, routes are looked up in the
+// FIB snapshot published by it. Forwarded packets are rewritten in the HAL
+// buffer they arrived in and sent from there; every frame is either sent or
+// released before returning. Packets addressed to the router, including RIP
+// to 224.0.0.9, are copied into the worker's ring to the control thread, and
+// true is returned for them. Next hops still being resolved are left to the
+// HAL, which holds their packets until the ARP reply.
+bool processFrame(HAL_Frame &frame, ControlRing &control) {
+  uint8_t *packet = frame.data;
+  size_t res = frame.length;
+
+  if (!validateIPChecksum(packet, res)) {
+    HAL_CountDrop(frame.if_index, HAL_DROP_BAD_CHECKSUM);
+    HAL_ReleaseFrames(&frame, 1);
+    return false;
+  }
+
+  in_addr_t src_addr, dst_addr;
+  memcpy(&src_addr, &packet[12], sizeof(in_addr_t));
+  memcpy(&dst_addr, &packet[16], sizeof(in_addr_t));
+
+  bool dst_is_me = false;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (memcmp(&dst_addr, &addrs[i], sizeof(in_addr_t)) == 0) { dst_is_me = true; break; }
+  }
+  dst_is_me = dst_is_me || memcmp(&dst_addr, &multicast_addr, sizeof(in_addr_t)) == 0 ;
+
+  if (dst_is_me) {
+    // nothing the control thread handles is larger
+    if (res > CONTROL_PACKET_MTU) {
+      HAL_CountDrop(frame.if_index, HAL_DROP_OVERSIZE);
+      HAL_ReleaseFrames(&frame, 1);
+      return false;
+    }
+    ControlPacket *in = control.back();
+    if (!in) {
+      LOG_DEBUG("Control ring full, packet from %08x dropped\n", src_addr);
+      HAL_CountDrop(frame.if_index, HAL_DROP_NO_BUFFER);
+      HAL_ReleaseFrames(&frame, 1);
+      return false;
+    }
+    memcpy(in->data, packet, res);
+    in->length = res;
+    in->if_index = frame.if_index;
+    memcpy(in->mac, frame.src_mac, sizeof(macaddr_t));
+    HAL_ReleaseFrames(&frame, 1);
+    control.push();
+    return true;
+  } else { // !dst_is_me
+    LOG_DEBUG("Forward packet from %08x to %08x on interface %d\n", src_addr, dst_addr, frame.if_index);
+    // the adjacency belongs to the published FIB, keep it until the frame is
+    // queued
+    RcuReadGuard guard;
+    const Adjacency *adj = queryAdjacency(dst_addr);
+
+    if (adj) {
+      if(packet[8] <= 1) {
+        LOG_DEBUG("TTL expired for %08x\n", dst_addr);
+        HAL_CountDrop(frame.if_index, HAL_DROP_TTL_EXPIRED);
+        HAL_ReleaseFrames(&frame, 1);
+        return false;
+      }
+      if (adjacencyResolved(*adj)) {
+        // the checksum was validated above, only patch it for the new TTL
+        decrementTTL(packet);
+        // queued on the interface with the prebuilt header, flushed once the
+        // burst is done
+        HAL_SendFramesVia(&adj->link, &frame, 1);
+        return false;
+      }
+      // directly connected, or the next hop is still being resolved: the HAL
+      // looks up the MAC address, and holds the packet until the ARP reply
+      // if it has to ask, and counts it as dropped if it cannot
+      uint32_t nexthop = adj->nexthop ? adj->nexthop : dst_addr;
+      decrementTTL(packet);
+      HAL_SendFramesToNeighbor(adj->if_index, nexthop, &frame, 1);
+      return false;
+    }
+    LOG_DEBUG("No route for %08x\n", dst_addr);
+    HAL_CountDrop(frame.if_index, HAL_DROP_NO_ROUTE);
+    HAL_ReleaseFrames(&frame, 1);
+    return false;
+  }
+}
+
+void handleRip(const uint8_t *packet, int res, int if_index) {
+  in_addr_t src_addr;
+  memcpy(&src_addr, &packet[12], sizeof(in_addr_t));
+  RipView rip;
+  if (rip.parse(packet, res)) {
+    if (rip.command() != 1) {
+      LOG_INFO("\n*** Get Response Packet From %08x ***\n", src_addr);
+      // apply the whole packet to the RIB at once, the FIB is patched on commit
+      beginUpdate();
+      for (RipView::Iterator it = rip.begin(); it != rip.end(); ++it) {
+        RipEntry entry = *it;
+        RoutingTableEntry routingTableEntry = {
+          .addr = entry.addr,
+          .len = maskToLen(entry.mask),
+          .if_index = (uint32_t)if_index,
+          .nexthop = src_addr,
+          .metric = entry.metric < 16 ? entry.metric + 1 : 16
+        };
+        // 16 and above is unreachable: the route is timed out at once
+        update(routingTableEntry);
+      }
+      commitUpdate();
+    }
+  } else if (res >= 24 && packet[9] == 17) {
+    // UDP to port 520 that is not valid RIP
+    uint32_t ip_header = (packet[0] & 0xf) * 4;
+    if ((uint32_t)res >= ip_header + 4 && ((packet[ip_header + 2] << 8) | packet[ip_header + 3]) == 520)
+      HAL_CountDrop(if_index, HAL_DROP_BAD_RIP);
+  }
+}
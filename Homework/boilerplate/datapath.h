@@ -0,0 +1,40 @@
+#ifndef __DATAPATH_H__
+#define __DATAPATH_H__
+
+#include "router_hal.h"
+#include "spsc_ring.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// The per-packet path shared by the router and router_bench, so that the
+// benchmark measures the code that forwards.
+
+// the largest packet handed to or from the control thread: a full RIP
+// response with the longest IP header is 60 + 8 + 4 + 25 * 20 = 572 bytes
+#define CONTROL_PACKET_MTU 576
+// packets each worker can have waiting for the control thread
+#define CONTROL_RING_SIZE 256
+
+// a packet handed between the forwarding workers and the control thread,
+// written and read in place in a ring slot
+struct ControlPacket {
+  uint8_t data[CONTROL_PACKET_MTU];
+  uint32_t length;
+  int if_index;
+  macaddr_t mac;
+};
+typedef SpscRing<ControlPacket, CONTROL_RING_SIZE> ControlRing;
+
+// addresses of the router on each interface, and the RIP multicast group;
+// defined by the program
+extern in_addr_t addrs[N_IFACE_ON_BOARD];
+extern in_addr_t multicast_addr;
+
+// forwards a received frame or queues it for the control thread, returns
+// true for the latter
+bool processFrame(HAL_Frame &frame, ControlRing &control);
+// applies a RIP packet addressed to the router to the RIB, on the control
+// thread
+void handleRip(const uint8_t *packet, int res, int if_index);
+
+#endif
@@ -0,0 +1,116 @@
+#include "dir24_8.h"
+
+Dir24_8::Dir24_8() {
+  // calloc'd pages are only faulted in once a prefix touches them
+  tbl24 = (uint16_t *)calloc(TBL24_SIZE, sizeof(uint16_t));
+  tbl24Depth = (uint8_t *)calloc(TBL24_SIZE, sizeof(uint8_t));
+}
+
+Dir24_8::~Dir24_8() {
+  free(tbl24);
+  free(tbl24Depth);
+}
+
+uint32_t Dir24_8::allocGroup(uint16_t fill, uint8_t depth) {
+  uint32_t group;
+  if (!freeGroups.empty()) {
+    group = freeGroups.back();
+    freeGroups.pop_back();
+  } else {
+    group = tbl8.size() / GROUP_SIZE;
+    if (group >= GROUP_FLAG) return GROUP_FLAG;
+    tbl8.resize(tbl8.size() + GROUP_SIZE);
+    tbl8Depth.resize(tbl8Depth.size() + GROUP_SIZE);
+  }
+  uint32_t base = group * GROUP_SIZE;
+  for (uint32_t i = 0; i < GROUP_SIZE; i++) {
+    tbl8[base + i] = fill;
+    tbl8Depth[base + i] = depth;
+  }
+  return group;
+}
+
+void Dir24_8::collapseGroup(uint32_t idx24) {
+  uint32_t group = tbl24[idx24] & ~GROUP_FLAG;
+  uint32_t base = group * GROUP_SIZE;
+  // once nothing longer than /24 is left, every entry carries the same route
+  for (uint32_t i = 0; i < GROUP_SIZE; i++) {
+    if (tbl8Depth[base + i] > 24) return;
+  }
+  tbl24[idx24] = tbl8[base];
+  tbl24Depth[idx24] = tbl8Depth[base];
+  freeGroups.push_back(group);
+}
+
+void Dir24_8::paint(uint32_t key, uint32_t len, uint16_t adj, uint8_t depth,
+                    bool removing) {
+  if (len <= 24) {
+    uint32_t first = key >> 8;
+    uint32_t count = 1u << (24 - len);
+    for (uint32_t i = first; i < first + count; i++) {
+      if (tbl24[i] & GROUP_FLAG) {
+        uint32_t base = (tbl24[i] & ~GROUP_FLAG) * GROUP_SIZE;
+        for (uint32_t j = base; j < base + GROUP_SIZE; j++) {
+          if (removing ? tbl8Depth[j] == len : tbl8Depth[j] <= len) {
+            tbl8[j] = adj;
+            tbl8Depth[j] = depth;
+          }
+        }
+      } else if (removing ? tbl24Depth[i] == len : tbl24Depth[i] <= len) {
+        tbl24[i] = adj;
+        tbl24Depth[i] = depth;
+      }
+    }
+    return;
+  }
+
+  uint32_t idx24 = key >> 8;
+  if (!(tbl24[idx24] & GROUP_FLAG)) {
+    if (removing) return;
+    uint32_t group = allocGroup(tbl24[idx24], tbl24Depth[idx24]);
+    if (group == GROUP_FLAG) return;
+    tbl24[idx24] = GROUP_FLAG | group;
+  }
+  uint32_t base = (tbl24[idx24] & ~GROUP_FLAG) * GROUP_SIZE;
+  uint32_t first = base + (key & 0xff);
+  uint32_t count = 1u << (32 - len);
+  for (uint32_t j = first; j < first + count; j++) {
+    if (removing ? tbl8Depth[j] == len : tbl8Depth[j] <= len) {
+      tbl8[j] = adj;
+      tbl8Depth[j] = depth;
+    }
+  }
+  if (removing) collapseGroup(idx24);
+}
+
+bool Dir24_8::insert(uint32_t key, uint32_t len, uint16_t adj) {
+  key &= prefixMask(len);
+  if (len > 24 && !(tbl24[key >> 8] & GROUP_FLAG) && freeGroups.empty() &&
+      tbl8.size() / GROUP_SIZE >= GROUP_FLAG) {
+    return false;
+  }
+  prefixes[prefixKey(key, len)] = adj;
+  paint(key, len, adj, len, false);
+  return true;
+}
+
+bool Dir24_8::remove(uint32_t key, uint32_t len) {
+  key &= prefixMask(len);
+  auto it = prefixes.find(prefixKey(key, len));
+  if (it == prefixes.end()) return false;
+  prefixes.erase(it);
+
+  // entries owned by this prefix fall back to the longest covering one
+  uint16_t coverAdj = 0;
+  uint8_t coverLen = 0;
+  for (int l = (int)len - 1; l >= 0; l--) {
+    auto c = prefixes.find(prefixKey(key & prefixMask(l), l));
+    if (c != prefixes.end()) {
+      coverAdj = c->second;
+      coverLen = l;
+      break;
+    }
+  }
+  paint(key, len, coverAdj, coverLen, true);
+  return true;
+}
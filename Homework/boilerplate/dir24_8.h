@@ -0,0 +1,76 @@
+#ifndef __DIR24_8_H__
+#define __DIR24_8_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+// DIR-24-8 direct-indexed forwarding table.
+//
+// tbl24 is indexed by the top 24 bits of the address. An entry either holds an
+// adjacency index directly or, with GROUP_FLAG set, the number of a 256-entry
+// tbl8 group indexed by the low 8 bits, so a lookup costs one or two reads.
+// Keys are IPv4 addresses in host byte order, values are adjacency indices
+// below 0x8000 and 0 means no route.
+class Dir24_8 {
+public:
+  static const uint16_t GROUP_FLAG = 0x8000;
+  static const uint32_t TBL24_SIZE = 1 << 24;
+  static const uint32_t GROUP_SIZE = 1 << 8;
+
+  Dir24_8();
+  ~Dir24_8();
+  Dir24_8(const Dir24_8 &) = delete;
+  Dir24_8 &operator=(const Dir24_8 &) = delete;
+
+  bool insert(uint32_t key, uint32_t len, uint16_t adj);
+  bool remove(uint32_t key, uint32_t len);
+  // exact match, returns the adjacency installed for key/len or 0
+  uint16_t find(uint32_t key, uint32_t len) const {
+    auto it = prefixes.find(prefixKey(key & prefixMask(len), len));
+    return it == prefixes.end() ? 0 : it->second;
+  }
+
+  uint16_t lookup(uint32_t key) const {
+    uint16_t e = tbl24[key >> 8];
+    if (e & GROUP_FLAG) {
+      e = tbl8[((uint32_t)(e & ~GROUP_FLAG) << 8) | (key & 0xff)];
+    }
+    return e;
+  }
+
+  size_t size() const { return prefixes.size(); }
+  // bytes of the tables as allocated, the exact-match index not counted;
+  // tbl24 counts in full although only the pages in use are backed
+  size_t memory() const {
+    return TBL24_SIZE * (sizeof(uint16_t) + sizeof(uint8_t)) +
+           tbl8.capacity() * sizeof(uint16_t) + tbl8Depth.capacity();
+  }
+
+private:
+  static uint32_t prefixMask(uint32_t len) {
+    return len ? ~0u << (32 - len) : 0;
+  }
+  static uint64_t prefixKey(uint32_t key, uint32_t len) {
+    return ((uint64_t)key << 8) | len;
+  }
+
+  // Writes adj/depth into every entry covered by key/len. On insert, entries
+  // owned by a prefix no longer than len are taken over; on removal, only the
+  // entries owned by exactly len are handed back.
+  void paint(uint32_t key, uint32_t len, uint16_t adj, uint8_t depth,
+             bool removing);
+  uint32_t allocGroup(uint16_t fill, uint8_t depth);
+  void collapseGroup(uint32_t idx24);
+
+  uint16_t *tbl24;
+  // prefix length owning each entry, only read by updates
+  uint8_t *tbl24Depth;
+  std::vector<uint16_t> tbl8;
+  std::vector<uint8_t> tbl8Depth;
+  std::vector<uint32_t> freeGroups;
+  std::unordered_map<uint64_t, uint16_t> prefixes;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "fib.h"
+#include "logger.h"
+#include "rcu.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+
+bool Fib::install(uint32_t addr, uint32_t len, uint32_t nexthop,
+                  uint32_t if_index) {
+  uint32_t key = ntohl(addr);
+  uint16_t old = engine.find(key, len);
+  uint16_t adj = adjacencies.acquire(nexthop, if_index);
+  if (adj == AdjacencyTable::NONE) return false;
+  if (!engine.insert(key, len, adj)) {
+    adjacencies.release(adj);
+    return false;
+  }
+  adjacencies.release(old);
+  return true;
+}
+
+void Fib::withdraw(uint32_t addr, uint32_t len) {
+  uint32_t key = ntohl(addr);
+  uint16_t adj = engine.find(key, len);
+  if (engine.remove(key, len)) adjacencies.release(adj);
+}
+
+bool Fib::lookup(uint32_t addr, uint32_t *nexthop, uint32_t *if_index) const {
+  const Adjacency *a = route(addr);
+  if (!a) return false;
+  *nexthop = a->nexthop;
+  *if_index = a->if_index;
+  return true;
+}
+
+const Adjacency *Fib::route(uint32_t addr) const {
+  uint16_t adj = engine.lookup(ntohl(addr));
+  if (adj == AdjacencyTable::NONE) return NULL;
+  return &adjacencies.get(adj);
+}
+
+FibPublisher::FibPublisher() : current(&copies[0]), standbyRetired(0) {}
+
+void FibPublisher::install(uint32_t addr, uint32_t len, uint32_t nexthop,
+                           uint32_t if_index) {
+  FibOp op = {addr, len, nexthop, if_index, true};
+  batch.push_back(op);
+}
+
+void FibPublisher::withdraw(uint32_t addr, uint32_t len) {
+  FibOp op = {addr, len, 0, 0, false};
+  batch.push_back(op);
+}
+
+void FibPublisher::apply(Fib *fib, const std::vector<FibOp> &ops) {
+  for (size_t i = 0; i < ops.size(); i++) {
+    const FibOp &op = ops[i];
+    if (!op.install) {
+      fib->withdraw(op.addr, op.len);
+    } else if (!fib->install(op.addr, op.len, op.nexthop, op.if_index)) {
+      LOG_WARN("FIB full, %08x/%u is not forwarded\n", op.addr, op.len);
+    }
+  }
+}
+
+void FibPublisher::publish() {
+  if (batch.empty()) return;
+  Fib *active = current.load();
+  Fib *standby = active == &copies[0] ? &copies[1] : &copies[0];
+
+  // normally long over, readers only hold the FIB for a lookup
+  rcuWait(standbyRetired);
+  apply(standby, lagging);
+  apply(standby, batch);
+  current.store(standby);
+  standbyRetired = rcuRetire();
+
+  lagging.swap(batch);
+  batch.clear();
+}
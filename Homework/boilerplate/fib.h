@@ -0,0 +1,76 @@
+#ifndef __FIB_H__
+#define __FIB_H__
+
+#include "adjacency.h"
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#ifdef LOOKUP_ENGINE_DIR24_8
+#include "dir24_8.h"
+typedef Dir24_8 FibEngine;
+#else
+#include "trie.h"
+typedef MultibitTrie FibEngine;
+#endif
+
+// Forwarding table compiled from the RIB. It only knows where to send a
+// destination; metrics and alternative paths stay in the RIB. Addresses are
+// in network byte order like RoutingTableEntry.
+class Fib {
+public:
+  // insert or replace the forwarding entry for addr/len
+  bool install(uint32_t addr, uint32_t len, uint32_t nexthop, uint32_t if_index);
+  void withdraw(uint32_t addr, uint32_t len);
+  bool lookup(uint32_t addr, uint32_t *nexthop, uint32_t *if_index) const;
+  // adjacency of the route to addr, NULL if there is none
+  const Adjacency *route(uint32_t addr) const;
+
+  size_t size() const { return engine.size(); }
+
+private:
+  FibEngine engine;
+  AdjacencyTable adjacencies;
+};
+
+// Publishes the FIB to forwarding threads without locks.
+//
+// There are two Fib copies. Readers only ever see the published one, which is
+// never modified while it may be read. The control thread applies a batch to
+// the standby copy, swaps the pointer and keeps the batch around; the next
+// publish replays it on the old copy once RCU says no reader is left on it.
+class FibPublisher {
+public:
+  FibPublisher();
+
+  // control thread: queue changes for the next publish()
+  void install(uint32_t addr, uint32_t len, uint32_t nexthop, uint32_t if_index);
+  void withdraw(uint32_t addr, uint32_t len);
+  void publish();
+
+  // forwarding threads, only inside rcuReadLock()/rcuReadUnlock()
+  const Fib *reader() const { return current.load(); }
+
+private:
+  struct FibOp {
+    uint32_t addr;
+    uint32_t len;
+    uint32_t nexthop;
+    uint32_t if_index;
+    bool install;
+  };
+
+  void apply(Fib *fib, const std::vector<FibOp> &ops);
+
+  Fib copies[2];
+  std::atomic<Fib *> current;
+  // not published yet
+  std::vector<FibOp> batch;
+  // published, but not applied to the standby copy yet
+  std::vector<FibOp> lagging;
+  // RCU token taken when the standby copy was unpublished
+  uint64_t standbyRetired;
+};
+
+#endif
@@ -1,41 +1,30 @@
+#include "checksum.h"
 #include <stdint.h>
 #include <stdlib.h>
 
-unsigned int addWhileF(unsigned int a, unsigned int b){
-  int res = a+b;
-  while(res  >= 65536)
-    res = (res & 0xFFFF) + (res >> 16);
-  return res;
+bool validateIPChecksumF(const uint8_t *packet, size_t len) {
+  return validateIPChecksum(packet, len);
 }
 
-bool validateIPChecksumF(uint8_t *packet, size_t len) {
-   int head_length = (packet[0] % 16)  * 4;
-   unsigned int sum = (packet[10] << 8) + packet[11];
-   unsigned int predict_sum = 0;
-   auto phi = packet[10];
-   auto plo = packet[11];
-   packet[10] = 0;
-   packet[11] = 0;
-   for(int i = 0 ; i < head_length/2 ; i++)
-     predict_sum = addWhileF(predict_sum, (unsigned)(packet[i*2] << 8)+packet[2*i+1]);
-   predict_sum = (~predict_sum) & 0xFFFF;
-   packet[10] = phi;
-   packet[11] = plo;
-   return predict_sum == sum;
- }
+// decrements TTL and patches the header checksum for the change, HC' =
+// ~(~HC + ~m + m') from RFC 1624. The checksum must already be valid.
+void decrementTTL(uint8_t *packet) {
+  // TTL is the high byte of the 16-bit word at offset 8
+  unsigned int old_word = (packet[8] << 8) + packet[9];
+  packet[8]--;
+  unsigned int new_word = (packet[8] << 8) + packet[9];
+  unsigned int sum = (~((packet[10] << 8) + packet[11]) & 0xFFFF) +
+                     (~old_word & 0xFFFF) + new_word;
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (~sum) & 0xFFFF;
+  packet[10] = sum >> 8;
+  packet[11] = sum & 0xFF;
+}
 
 bool forward(uint8_t *packet, size_t len) {
   if(validateIPChecksumF(packet, len)){
-    int len_head = (packet[0] % 16) * 4;
-    unsigned int predict_sum = 0;
-    packet[8]--;
-    packet[10] = 0;
-    packet[11] = 0;
-    for(int i =0;i<len_head / 2;i++)
-      predict_sum = addWhileF(predict_sum, (unsigned)(packet[i*2] << 8)+packet[2*i+1]);
-    predict_sum =  (~predict_sum) & 0xFFFF;
-    packet[10] = predict_sum >> 8;
-    packet[11] = predict_sum & 0xFF;
+    decrementTTL(packet);
     return true;
   } else return false;
 }
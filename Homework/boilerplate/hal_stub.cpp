@@ -0,0 +1,16 @@
+#include "router_hal.h"
+
+// The HAL as far as lpm_bench needs it, so that it builds without libpcap or
+// any interface. The routing tables it measures (lookup.cpp, fib.cpp) call
+// the HAL only through AdjacencyTable in adjacency.cpp, which attaches the
+// adjacency of each next hop when it is first acquired and detaches it when
+// the last route through it goes away; these are those two calls. Adjacencies
+// are interned but never resolved. A new HAL call in adjacency.cpp, lookup.cpp
+// or fib.cpp has to be added here too, or lpm_bench no longer links.
+
+int HAL_AttachAdjacency(HAL_OUT HAL_Adjacency *adj) {
+  adj->valid = 0;
+  return HAL_ERR_NOT_SUPPORTED;
+}
+
+void HAL_DetachAdjacency(HAL_OUT HAL_Adjacency *) {}
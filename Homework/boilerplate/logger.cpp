@@ -0,0 +1,197 @@
+#include "logger.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// single producer, single consumer: the thread it belongs to writes records
+// at head, the background thread formats them at tail
+struct LogRing {
+  LogRecord records[LOG_RING_SIZE];
+  alignas(64) std::atomic<uint32_t> head;
+  // the producer's last look at tail, so that it only reads the consumer's
+  // line when the ring seems full
+  uint32_t limit;
+  std::atomic<uint64_t> dropped;
+  // set from logReserve() to logCommit(), so that logStop() can wait for a
+  // record that was started while the logger ran, and the background thread
+  // does not go to sleep under it
+  std::atomic<bool> writing;
+  alignas(64) std::atomic<uint32_t> tail;
+  // drops already reported, by the consumer
+  uint64_t reported;
+};
+
+// one per thread that has logged while the background thread ran, threads
+// beyond these write their records at once
+static LogRing logRings[LOG_MAX_THREADS];
+static std::atomic<int> logRingsUsed(0);
+static std::atomic<bool> logRunning(false);
+static std::thread logThread;
+
+// The background thread sleeps on logReady once it has found every ring
+// empty after setting logSleeping; the producer that clears logSleeping when
+// it reserves a record wakes it after the commit. Producers waiting for room
+// sleep on logRoom, woken after every pass that wrote something.
+static std::mutex logLock;
+static std::condition_variable logReady;
+static std::condition_variable logRoom;
+static std::atomic<bool> logSleeping(false);
+static std::atomic<int> logWaiting(0);
+
+static thread_local LogRing *ring = NULL;
+// whether the record being written has to wake the background thread
+static thread_local bool wake = false;
+// a record written at once, without the background thread
+static thread_local LogRecord direct;
+
+static LogRing *createRing() {
+  int used = logRingsUsed.load();
+  do {
+    if (used == LOG_MAX_THREADS) return NULL;
+  } while (!logRingsUsed.compare_exchange_weak(used, used + 1));
+  LogRing *r = &logRings[used];
+  r->limit = LOG_RING_SIZE;
+  return r;
+}
+
+// whether the ring of this thread has room, after another look at tail
+static bool hasRoom() {
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  if (head != ring->limit) return true;
+  ring->limit = ring->tail.load(std::memory_order_acquire) + LOG_RING_SIZE;
+  return head != ring->limit;
+}
+
+LogRecord *logReserve(bool wait) {
+  if (!logRunning.load(std::memory_order_relaxed)) return &direct;
+  if (!ring) ring = createRing();
+  if (!ring) return &direct;
+  // pairs with logStop(): either it sees writing set and waits for the
+  // record, or the check below sees the logger stopped. Likewise with the
+  // background thread going to sleep and logSleeping.
+  ring->writing.store(true);
+  if (!logRunning.load()) {
+    ring->writing.store(false, std::memory_order_relaxed);
+    return &direct;
+  }
+  // only the first record after it went to sleep wakes it
+  wake = logSleeping.load() && logSleeping.exchange(false);
+  if (!hasRoom()) {
+    if (!wait) {
+      ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+      ring->writing.store(false, std::memory_order_relaxed);
+      return NULL;
+    }
+    // the background thread is busy with this very ring, it cannot sleep
+    std::unique_lock<std::mutex> lock(logLock);
+    logWaiting++;
+    logRoom.wait(lock, [] { return hasRoom() || !logRunning.load(); });
+    logWaiting--;
+    if (!hasRoom()) {
+      // stopped meanwhile, logStop() drains the ring
+      ring->writing.store(false, std::memory_order_release);
+      return &direct;
+    }
+  }
+  return &ring->records[ring->head.load(std::memory_order_relaxed) & (LOG_RING_SIZE - 1)];
+}
+
+void logCommit(LogRecord *record) {
+  if (record == &direct) {
+    record->format(*record, stdout);
+    return;
+  }
+  ring->head.store(ring->head.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  ring->writing.store(false, std::memory_order_release);
+  if (wake) {
+    std::lock_guard<std::mutex> lock(logLock);
+    logReady.notify_one();
+  }
+}
+
+// formats what a ring holds, returns the number of records
+static uint32_t drain(LogRing *r, FILE *out) {
+  uint32_t tail = r->tail.load(std::memory_order_relaxed);
+  uint32_t head = r->head.load(std::memory_order_acquire);
+  for (uint32_t i = tail; i != head; i++) {
+    const LogRecord &record = r->records[i & (LOG_RING_SIZE - 1)];
+    record.format(record, out);
+  }
+  r->tail.store(head, std::memory_order_release);
+  uint64_t dropped = r->dropped.load(std::memory_order_relaxed);
+  if (dropped != r->reported) {
+    fprintf(out, "\n%llu log records dropped\n",
+            (unsigned long long)(dropped - r->reported));
+    r->reported = dropped;
+  }
+  return head - tail;
+}
+
+// sleeps until a producer wakes it or the logger stops, unless a record is
+// waiting. A record being written may have been started before logSleeping
+// was set, and then nobody wakes it for that one: it only naps.
+static void waitForRecords() {
+  std::unique_lock<std::mutex> lock(logLock);
+  logSleeping.store(true);
+  bool pending = !logRunning.load();
+  bool writing = false;
+  int used = logRingsUsed.load();
+  for (int i = 0; i < used && !pending; i++) {
+    LogRing &r = logRings[i];
+    writing = writing || r.writing.load();
+    pending = r.head.load(std::memory_order_relaxed) != r.tail.load(std::memory_order_relaxed);
+  }
+  // a producer may have started waiting for room after the last pass
+  if (logWaiting.load() > 0) logRoom.notify_all();
+  if (!pending && writing) logReady.wait_for(lock, std::chrono::milliseconds(1));
+  else if (!pending) logReady.wait(lock);
+  logSleeping.store(false, std::memory_order_relaxed);
+}
+
+static void logLoop() {
+  while (true) {
+    // one more pass after logStop(), for what was written before it
+    bool stopping = !logRunning.load(std::memory_order_acquire);
+    uint32_t written = 0;
+    int used = logRingsUsed.load(std::memory_order_acquire);
+    for (int i = 0; i < used; i++)
+      written += drain(&logRings[i], stdout);
+    if (written > 0) {
+      fflush(stdout);
+      if (logWaiting.load() > 0) {
+        std::lock_guard<std::mutex> lock(logLock);
+        logRoom.notify_all();
+      }
+    }
+    if (stopping) break;
+    if (written == 0) waitForRecords();
+  }
+}
+
+void logStart() {
+  if (logRunning.exchange(true)) return;
+  logThread = std::thread(logLoop);
+}
+
+void logStop() {
+  if (!logRunning.exchange(false)) return;
+  {
+    std::lock_guard<std::mutex> lock(logLock);
+    logReady.notify_one();
+    logRoom.notify_all();
+  }
+  logThread.join();
+  // records committed after the last pass of the background thread, by
+  // threads that found it running just before
+  int used = logRingsUsed.load();
+  for (int i = 0; i < used; i++) {
+    while (logRings[i].writing.load(std::memory_order_acquire))
+      std::this_thread::yield();
+    drain(&logRings[i], stdout);
+  }
+  fflush(stdout);
+}
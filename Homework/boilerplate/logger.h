@@ -0,0 +1,131 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <tuple>
+#include <type_traits>
+
+// Asynchronous logging, out of the way of the forwarding path.
+//
+// LOG_DEBUG(fmt, ...) and the like take a printf format and its arguments
+// but do not format them: the arguments are copied into a fixed-size record
+// in a ring of the calling thread, and a background thread started by
+// logStart() formats and writes the records to stdout. The format is checked
+// at compile time as for printf. Pointer arguments are only read when the
+// record is formatted, so %s takes static strings only. Records of one thread
+// come out in order, those of different threads in no particular order. A
+// LOG_DEBUG record, the kind written per packet, that finds its ring full is
+// dropped and counted; LOG_INFO and LOG_WARN wait for room instead, so that
+// e.g. a routing table dump comes out whole. Without the background thread,
+// before logStart() and after logStop(), records are written at once.
+//
+// Levels below LOG_LEVEL compile to nothing and their arguments are not
+// evaluated: build with -DLOG_LEVEL=LOG_LEVEL_DEBUG for a line per packet.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_NONE 3
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// the arguments are named but never evaluated, so they stay checked and used
+#define LOG_SKIP(...)                                                         \
+  do {                                                                        \
+    if (0) printf(__VA_ARGS__);                                               \
+  } while (0)
+#define LOG_WRITE(wait, ...)                                                  \
+  do {                                                                        \
+    if (0) printf(__VA_ARGS__);                                               \
+    logWrite(wait, __VA_ARGS__);                                              \
+  } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_WRITE(false, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_SKIP(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_WRITE(true, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_SKIP(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_WRITE(true, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_SKIP(__VA_ARGS__)
+#endif
+
+// records each thread can have waiting, a power of two
+#define LOG_RING_SIZE 1024
+// threads with a ring of their own
+#define LOG_MAX_THREADS 16
+
+struct LogRecord;
+typedef void (*LogFormatter)(const LogRecord &record, FILE *out);
+
+// one cache line: the formatter, the format and the arguments as a std::tuple
+struct LogRecord {
+  LogFormatter format;
+  const char *fmt;
+  alignas(8) unsigned char args[48];
+};
+
+// starts the background thread
+void logStart();
+// writes what is left and stops the background thread
+void logStop();
+
+// a record to fill in; if the ring of this thread is full, waits for room if
+// wait is set and returns NULL otherwise
+LogRecord *logReserve(bool wait);
+// hands the record from logReserve() over to be written
+void logCommit(LogRecord *record);
+
+template <size_t... I> struct LogIndices {};
+template <size_t N, size_t... I>
+struct LogMakeIndices : LogMakeIndices<N - 1, N - 1, I...> {};
+template <size_t... I> struct LogMakeIndices<0, I...> {
+  typedef LogIndices<I...> type;
+};
+
+template <typename... Args> struct LogScalars : std::true_type {};
+template <typename T, typename... Args>
+struct LogScalars<T, Args...>
+    : std::integral_constant<bool, std::is_scalar<T>::value &&
+                                       LogScalars<Args...>::value> {};
+
+template <typename Tuple, size_t... I>
+void logPrint(FILE *out, const char *fmt, const Tuple &args, LogIndices<I...>) {
+  fprintf(out, fmt, std::get<I>(args)...);
+}
+
+template <typename Tuple>
+void logPrint(FILE *out, const char *fmt, const Tuple &, LogIndices<>) {
+  fputs(fmt, out);
+}
+
+template <typename... Args>
+void logFormat(const LogRecord &record, FILE *out) {
+  typedef std::tuple<Args...> Tuple;
+  logPrint(out, record.fmt, *reinterpret_cast<const Tuple *>(record.args),
+           typename LogMakeIndices<sizeof...(Args)>::type());
+}
+
+template <typename... Args> void logWrite(bool wait, const char *fmt, Args... args) {
+  typedef std::tuple<Args...> Tuple;
+  static_assert(LogScalars<Args...>::value, "log arguments must be numbers or pointers");
+  static_assert(sizeof(Tuple) <= sizeof(LogRecord::args), "too many log arguments");
+  static_assert(alignof(Tuple) <= 8, "log arguments too strictly aligned");
+  LogRecord *record = logReserve(wait);
+  if (!record) return;
+  record->format = logFormat<Args...>;
+  record->fmt = fmt;
+  new (record->args) Tuple(args...);
+  logCommit(record);
+}
+
+#endif
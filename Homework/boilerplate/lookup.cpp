@@ -1,130 +1,321 @@
 #include "../boilerplate/router.h"
 #include "../boilerplate/rip.h"
+#include "fib.h"
+#include "logger.h"
+#include "rcu.h"
+#include "timer_wheel.h"
+#include "update_cache.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
+#include<unordered_map>
 #include<vector>
 #include<stdio.h>
 using namespace std;
 
+// RFC 2453 3.8: a learned route times out when its neighbour stops
+// advertising it, and is then advertised as unreachable until collected
+const uint32_t RIP_INFINITY = 16;
+const uint64_t RIP_TIMEOUT = 180 * 1000;
+const uint64_t RIP_GARBAGE_COLLECTION = 120 * 1000;
+
+// timers of the control thread, advanced by its loop
+extern TimerWheel timers;
+// arms the triggered update, if it is not armed yet
+extern void scheduleTriggeredUpdate();
+
+// one candidate path towards a prefix, identified by where it was learned
+struct RibRoute {
+  uint32_t nexthop;
+  uint32_t if_index;
+  uint32_t metric;
+  // timeout, then garbage-collection timer of a learned route; NONE for the
+  // configured ones
+  uint32_t timer;
+};
+
+struct RibEntry {
+  uint32_t addr;
+  uint32_t len;
+  vector<RibRoute> candidates;
+  // position of the selected route in routingTable, -1 if none
+  int32_t best;
+  bool dirty;
+  // the selected route changed since the last update was sent
+  bool changed;
+};
+
+// every candidate route per prefix
+unordered_map<uint64_t, RibEntry> rib;
+// selected route per prefix, this is what RIP advertises
 vector<RoutingTableEntry> routingTable;
+// forwarding table derived from routingTable, this is what query() reads,
+// possibly from another thread
+FibPublisher fib;
+// periodic update derived from routingTable, kept in the same order
+UpdateCache updateCache;
+
+// prefixes touched by the current batch
+vector<uint64_t> dirtyPrefixes;
+int batchDepth = 0;
+
+// prefixes to go into the next triggered update, and the routes taken from
+// them for the update being sent
+vector<uint64_t> changedPrefixes;
+vector<RoutingTableEntry> changedRoutes;
+
+static uint32_t lenToMask(uint32_t len) {
+  return len ? ~0u << (32 - len) : 0;
+}
+
+static uint64_t routeKey(uint32_t addr, uint32_t len) {
+  return ((uint64_t)addr << 8) | len;
+}
+
+static RibEntry &ribEntry(uint32_t addr, uint32_t len) {
+  uint64_t key = routeKey(addr, len);
+  auto it = rib.find(key);
+  if (it != rib.end()) return it->second;
+  RibEntry &e = rib[key];
+  e.addr = addr;
+  e.len = len;
+  e.best = -1;
+  e.dirty = false;
+  e.changed = false;
+  return e;
+}
+
+static void markDirty(RibEntry &e) {
+  if (e.dirty) return;
+  e.dirty = true;
+  dirtyPrefixes.push_back(routeKey(e.addr, e.len));
+}
+
+static void clearCandidates(RibEntry &e) {
+  for (size_t i = 0; i < e.candidates.size(); i++)
+    timers.destroy(e.candidates[i].timer);
+  e.candidates.clear();
+}
+
+static void markChanged(RibEntry &e) {
+  if (e.changed) return;
+  e.changed = true;
+  changedPrefixes.push_back(routeKey(e.addr, e.len));
+  scheduleTriggeredUpdate();
+}
+
+static void removeSelected(RibEntry &e) {
+  uint32_t pos = e.best;
+  e.best = -1;
+  // keep the vector dense by moving the last entry into the hole
+  if (pos + 1 != routingTable.size()) {
+    RoutingTableEntry &moved = routingTable[pos];
+    moved = routingTable.back();
+    rib[routeKey(moved.addr, moved.len)].best = pos;
+    updateCache.set(pos, moved);
+  }
+  routingTable.pop_back();
+  updateCache.resize(routingTable.size());
+}
+
+// re-select the best candidate of one prefix and patch only its FIB entry
+static void recompile(uint64_t key) {
+  auto it = rib.find(key);
+  if (it == rib.end()) return;
+  RibEntry &e = it->second;
+  e.dirty = false;
+
+  const RibRoute *best = NULL;
+  for (size_t i = 0; i < e.candidates.size(); i++) {
+    if (!best || e.candidates[i].metric < best->metric) best = &e.candidates[i];
+  }
+
+  if (!best) {
+    if (e.best >= 0) {
+      if (routingTable[e.best].metric < RIP_INFINITY) fib.withdraw(e.addr, e.len);
+      removeSelected(e);
+    }
+    rib.erase(it);
+    return;
+  }
+
+  RoutingTableEntry selected = {
+    .addr = e.addr,
+    .len = e.len,
+    .if_index = best->if_index,
+    .nexthop = best->nexthop,
+    .metric = best->metric
+  };
+  // an unreachable route stays selected, so that it is advertised, but is
+  // not forwarded to
+  bool reachable = selected.metric < RIP_INFINITY;
+  bool wasReachable = false;
+  bool forwardingChanged = true;
+  if (e.best < 0) {
+    e.best = routingTable.size();
+    routingTable.push_back(selected);
+    updateCache.set(e.best, selected);
+    markChanged(e);
+  } else {
+    RoutingTableEntry &cur = routingTable[e.best];
+    wasReachable = cur.metric < RIP_INFINITY;
+    forwardingChanged = cur.nexthop != selected.nexthop || cur.if_index != selected.if_index ||
+                        reachable != wasReachable;
+    if (forwardingChanged || cur.metric != selected.metric) {
+      markChanged(e);
+      updateCache.set(e.best, selected);
+    }
+    cur = selected;
+  }
+  if (!forwardingChanged) return;
+  if (reachable)
+    fib.install(e.addr, e.len, selected.nexthop, selected.if_index);
+  else if (wasReachable)
+    fib.withdraw(e.addr, e.len);
+}
+
+void beginUpdate() {
+  batchDepth++;
+}
+
+void commitUpdate() {
+  if (--batchDepth > 0) return;
+  for (size_t i = 0; i < dirtyPrefixes.size(); i++)
+    recompile(dirtyPrefixes[i]);
+  dirtyPrefixes.clear();
+  fib.publish();
+}
+
+static RibRoute *findCandidate(RibEntry &e, uint32_t nexthop, uint32_t if_index) {
+  for (size_t i = 0; i < e.candidates.size(); i++) {
+    RibRoute &c = e.candidates[i];
+    if (c.nexthop == nexthop && c.if_index == if_index) return &c;
+  }
+  return NULL;
+}
+
+static RibRoute &setCandidate(RibEntry &e, const RoutingTableEntry &entry) {
+  RibRoute *c = findCandidate(e, entry.nexthop, entry.if_index);
+  if (c) {
+    if (c->metric != entry.metric) {
+      c->metric = entry.metric;
+      markDirty(e);
+    }
+    return *c;
+  }
+  RibRoute added = {entry.nexthop, entry.if_index, entry.metric, TimerWheel::NONE};
+  e.candidates.push_back(added);
+  markDirty(e);
+  return e.candidates.back();
+}
+
+// a learned route's timer fired: it has timed out, or has been unreachable
+// long enough to be collected
+static void routeTimer(uint32_t timer, void *arg) {
+  RibEntry &e = *(RibEntry *)arg;
+  for (size_t i = 0; i < e.candidates.size(); i++) {
+    if (e.candidates[i].timer != timer) continue;
+    beginUpdate();
+    if (e.candidates[i].metric < RIP_INFINITY) {
+      e.candidates[i].metric = RIP_INFINITY;
+      timers.arm(timer, timers.now() + RIP_GARBAGE_COLLECTION);
+    } else {
+      timers.destroy(timer);
+      e.candidates.erase(e.candidates.begin() + i);
+    }
+    markDirty(e);
+    commitUpdate();
+    return;
+  }
+}
 
 void update(bool insert, RoutingTableEntry entry) {
-  auto iter = routingTable.cbegin();
-  while(iter != routingTable.cend()){
-    RoutingTableEntry getTable = *iter;
-    if(getTable.addr == entry.addr && getTable.len == entry.len){
-      routingTable.erase(iter);
-      if(insert)
-        break;
-      else
-        return;
-      }
-    iter++;
+  entry.addr &= htonl(lenToMask(entry.len));
+  beginUpdate();
+  RibEntry &e = ribEntry(entry.addr, entry.len);
+  if (insert) {
+    setCandidate(e, entry);
+  } else {
+    clearCandidates(e);
+    markDirty(e);
   }
-  if(insert)
-    routingTable.insert(routingTable.end(), entry);
+  commitUpdate();
 }
 
+// safe to call from forwarding threads while the control thread updates
 bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index) {
   *nexthop = 0;
   *if_index = 0;
-  uint32_t lenBound = 0;
-
-  auto iter = routingTable.cbegin();
-  while(iter != routingTable.cend()){
-    RoutingTableEntry getTable = *iter;
-
-    uint32_t addrRes = getTable.addr ^ addr;
-    addrRes = addrRes << (32-getTable.len);
-    if(addrRes == 0 && getTable.len > lenBound){
-      lenBound = getTable.len;
-      *nexthop = getTable.nexthop;
-      *if_index = getTable.if_index;
-    }
-    iter++;
-  }
-  if(lenBound != 0)
-    return true;
-  else
-    return false;
+  RcuReadGuard guard;
+  return fib.reader()->lookup(addr, nexthop, if_index);
 }
 
-void response(RipPacket *resp, uint32_t if_index){
-  resp->command = 0x2;
-  int entry_num = 0;
-  for (uint32_t i = 0; i < routingTable.size(); i++) {
-    if(routingTable[i].if_index == if_index) continue; //如果同一个端口 则不加入这条路由表条目
-    uint32_t mask =  ((0x1 << routingTable[i].len) - 1);
-    uint32_t correct_mask = 0;
-    if(routingTable[i].len == 32)
-      correct_mask = 0xffffffff;
-    else{
-      for(int i=0;i<4;i++)
-        correct_mask += ((mask >> (i*8)) & 0xff) << ((3-i) * 8);
-    }
-    RipEntry entry = {
-        .addr = routingTable[i].addr,
-        .mask = mask,
-        .nexthop = routingTable[i].nexthop,
-        .metric = routingTable[i].metric
-    };
-    resp->entries[entry_num++] = entry;
+// like query(), but hands out the adjacency itself for the forwarding path;
+// the caller must hold an RCU read lock for as long as it uses the result
+const Adjacency *queryAdjacency(uint32_t addr) {
+  return fib.reader()->route(addr);
+}
+
+// moves the routes changed since the last update out for a triggered update,
+// returns how many there are
+int takeChangedRoutes() {
+  changedRoutes.clear();
+  for (size_t i = 0; i < changedPrefixes.size(); i++) {
+    auto it = rib.find(changedPrefixes[i]);
+    // collected in the meantime
+    if (it == rib.end()) continue;
+    it->second.changed = false;
+    if (it->second.best >= 0) changedRoutes.push_back(routingTable[it->second.best]);
   }
-  resp->numEntries = entry_num;
+  changedPrefixes.clear();
+  return changedRoutes.size();
 }
 
-void response(RipPacket *resp, uint32_t if_index, int table_index){
+// a RIP response of up to 25 routes taken by takeChangedRoutes(), starting at
+// *next which it moves past them; poisoned reverse like the periodic update
+void changedResponse(RipPacket *resp, uint32_t if_index, uint32_t *next) {
   resp->command = 0x2;
   int entry_num = 0;
-  for (uint32_t i = table_index; i < routingTable.size() && i < table_index+25; i++) {
-    if(routingTable[i].if_index == if_index) continue;
-    uint32_t mask =  ((0x1 << routingTable[i].len) - 1);
-    uint32_t correct_mask = 0;
-    if(routingTable[i].len == 32)
-      correct_mask = 0xffffffff;
-    else{
-      for(int i=0;i<4;i++)
-        correct_mask += ((mask >> (i*8)) & 0xff) << ((3-i) * 8);
-    }
+  for (; *next < changedRoutes.size() && entry_num < RIP_MAX_ENTRY; (*next)++) {
+    const RoutingTableEntry &route = changedRoutes[*next];
     RipEntry entry = {
-        .addr = routingTable[i].addr,
-        .mask = mask,
-        .nexthop = routingTable[i].nexthop,
-        .metric = routingTable[i].metric
+        .addr = route.addr,
+        .mask = htonl(lenToMask(route.len)),
+        .nexthop = route.nexthop,
+        .metric = route.if_index == if_index ? RIP_INFINITY : route.metric
     };
     resp->entries[entry_num++] = entry;
   }
   resp->numEntries = entry_num;
 }
 
-
 int getRoutingTableSize(){
   return routingTable.size();
 }
 
+// a route learned from a RIP neighbour, it replaces whatever the same
+// neighbour advertised before for this prefix and restarts its timeout. An
+// unreachable metric starts the deletion right away, as a timeout would.
 void update(RoutingTableEntry entry) {
-  auto iter = routingTable.cbegin();
-  bool update_flag = true;
-  while(iter != routingTable.cend()){
-    RoutingTableEntry getTable = *iter;
-    if(getTable.addr == entry.addr && getTable.len == entry.len){
-      update_flag = false;
-      if(entry.if_index == getTable.if_index || entry.metric <= getTable.metric){
-        if (getTable.nexthop != 0) {
-          routingTable.erase(iter);
-          update_flag = true;
-        }
-      }
-      break;
-    }
-    iter++;
+  entry.addr &= htonl(lenToMask(entry.len));
+  if (entry.metric >= RIP_INFINITY) {
+    auto it = rib.find(routeKey(entry.addr, entry.len));
+    if (it == rib.end()) return;
+    RibRoute *c = findCandidate(it->second, entry.nexthop, entry.if_index);
+    if (c && c->timer != TimerWheel::NONE && c->metric < RIP_INFINITY)
+      timers.arm(c->timer, timers.now());
+    return;
   }
-  if(update_flag)
-    routingTable.insert(routingTable.end(), entry);
+  beginUpdate();
+  RibEntry &e = ribEntry(entry.addr, entry.len);
+  RibRoute &c = setCandidate(e, entry);
+  if (c.timer == TimerWheel::NONE) c.timer = timers.create(routeTimer, &e);
+  timers.arm(c.timer, timers.now() + RIP_TIMEOUT);
+  commitUpdate();
 }
 
 void printTable(){
-  printf("RIP Table of the router now:\n");
+  LOG_INFO("RIP Table of the router now:\n");
   for(int i = 0 ; i < routingTable.size() ; i++){
     auto entry = routingTable[i];
     uint32_t dest[4];
@@ -133,6 +324,6 @@ void printTable(){
       dest[i] = (entry.addr >> (i * 8)) & 0xff;
       nexthop[i] = (entry.nexthop >> (i * 8)) & 0xff;
     }
-    printf("%u.%u.%u.%u via %u.%u.%u.%u with length: %u interface: %u metric: %u\n", dest[0], dest[1], dest[2], dest[3], nexthop[0], nexthop[1],nexthop[2],nexthop[3], entry.len, entry.if_index, entry.metric);
+    LOG_INFO("%u.%u.%u.%u via %u.%u.%u.%u with length: %u interface: %u metric: %u\n", dest[0], dest[1], dest[2], dest[3], nexthop[0], nexthop[1],nexthop[2],nexthop[3], entry.len, entry.if_index, entry.metric);
   }
 }
@@ -0,0 +1,390 @@
+#include "dir24_8.h"
+#include "router.h"
+#include "router_hal.h"
+#include "timer_wheel.h"
+#include "trie.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Longest prefix match engines on a realistic prefix set:
+//
+//   ./lpm_bench ../../SetupJoint/as4538_prefixes
+//   ./lpm_bench -s 500000 -n 4194304
+//
+// Prefixes are read from anything in the file that looks like a.b.c.d/len,
+// so the JSON prefix list, bird configurations and plain lists all work; -s
+// generates a BGP-like set instead. Each engine is built from the set, timed
+// under every workload and compared with a reference on every query and on
+// both ends of every prefix. Then half of the prefixes are withdrawn and the
+// rest re-installed with new next hops, and it is compared again after each
+// step. Exits with 1 if any engine disagrees with the reference.
+
+extern void update(bool insert, RoutingTableEntry entry);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+extern void beginUpdate();
+extern void commitUpdate();
+
+// lookup.cpp runs the timers of learned routes here; only configured routes
+// are used, so they never fire
+TimerWheel timers;
+void scheduleTriggeredUpdate() {}
+
+// next hops the prefixes are spread over
+const int ADJACENCIES = 1000;
+// routes per RIB batch, as in a full RIP response
+const int RIB_BATCH = 25;
+
+struct Prefix {
+  // host byte order, host bits clear
+  uint32_t key;
+  uint32_t len;
+  uint16_t adj;
+};
+
+static uint32_t prefixMask(uint32_t len) {
+  return len ? ~0u << (32 - len) : 0;
+}
+
+// The obvious longest prefix match: one exact-match table per length, probed
+// from the longest down.
+class Reference {
+public:
+  void insert(uint32_t key, uint32_t len, uint16_t adj) { tables[len][key] = adj; }
+  void remove(uint32_t key, uint32_t len) { tables[len].erase(key); }
+  uint16_t lookup(uint32_t key) const {
+    for (int len = 32; len >= 0; len--) {
+      auto it = tables[len].find(key & prefixMask(len));
+      if (it != tables[len].end()) return it->second;
+    }
+    return 0;
+  }
+
+private:
+  std::unordered_map<uint32_t, uint16_t> tables[33];
+};
+
+// a FIB engine used directly, as FibEngine in fib.h
+template <class Table> class DirectEngine {
+public:
+  void begin() {}
+  void commit() {}
+  void insert(const Prefix &p) { table.insert(p.key, p.len, p.adj); }
+  void remove(const Prefix &p) { table.remove(p.key, p.len); }
+  uint16_t lookup(uint32_t key) const { return table.lookup(key); }
+  size_t memory() const { return table.memory(); }
+
+private:
+  Table table;
+};
+
+// the RIB of lookup.cpp through update() and query(), that is with route
+// selection, the adjacency table and FIB publication; adj is carried in the
+// next hop. A new next hop is a new path to the RIB, so replacing a route
+// withdraws the old one in the same batch.
+class RibEngine {
+public:
+  static const uint32_t NEXTHOP_BASE = 0x0a000000;
+
+  RibEngine() : pending(0) {}
+  void begin() {}
+  void commit() { flush(); }
+  void insert(const Prefix &p) {
+    RoutingTableEntry entry = {
+        .addr = htonl(p.key),
+        .len = p.len,
+        .if_index = (uint32_t)(p.adj % N_IFACE_ON_BOARD),
+        .nexthop = htonl(NEXTHOP_BASE + p.adj),
+        .metric = 1
+    };
+    batch();
+    uint64_t key = ((uint64_t)p.key << 8) | p.len;
+    if (!installed.insert(key).second) update(false, entry);
+    update(true, entry);
+  }
+  void remove(const Prefix &p) {
+    RoutingTableEntry entry = {htonl(p.key), p.len, 0, 0, 0};
+    installed.erase(((uint64_t)p.key << 8) | p.len);
+    batch();
+    update(false, entry);
+  }
+  uint16_t lookup(uint32_t key) const {
+    uint32_t nexthop, if_index;
+    if (!query(htonl(key), &nexthop, &if_index)) return 0;
+    return ntohl(nexthop) - NEXTHOP_BASE;
+  }
+  size_t memory() const { return 0; }
+
+private:
+  void batch() {
+    if (pending == RIB_BATCH) flush();
+    if (pending++ == 0) beginUpdate();
+  }
+  void flush() {
+    if (pending > 0) commitUpdate();
+    pending = 0;
+  }
+
+  int pending;
+  std::unordered_set<uint64_t> installed;
+};
+
+static double seconds(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void addPrefix(std::vector<Prefix> &prefixes, std::unordered_set<uint64_t> &seen,
+                      uint32_t key, uint32_t len, std::mt19937 &rng) {
+  key &= prefixMask(len);
+  if (!seen.insert(((uint64_t)key << 8) | len).second) return;
+  Prefix p = {key, len, (uint16_t)(1 + rng() % ADJACENCIES)};
+  prefixes.push_back(p);
+}
+
+// every a.b.c.d/len in the file, the slash may be escaped as in JSON
+static bool loadPrefixes(const char *path, std::vector<Prefix> &prefixes, std::mt19937 &rng) {
+  FILE *f = fopen(path, "r");
+  if (!f) return false;
+  std::string text;
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) text.append(buffer, n);
+  fclose(f);
+
+  std::unordered_set<uint64_t> seen;
+  const char *s = text.c_str();
+  for (size_t i = 0; i < text.size(); i++) {
+    if (!isdigit(s[i]) || (i > 0 && (isdigit(s[i - 1]) || s[i - 1] == '.'))) continue;
+    unsigned a, b, c, d, len;
+    int used = 0;
+    if (sscanf(s + i, "%3u.%3u.%3u.%3u%n", &a, &b, &c, &d, &used) != 4) continue;
+    const char *rest = s + i + used;
+    if (*rest == '\\') rest++;
+    if (*rest != '/' || !isdigit(rest[1])) continue;
+    len = atoi(rest + 1);
+    if (a > 255 || b > 255 || c > 255 || d > 255 || len > 32) continue;
+    addPrefix(prefixes, seen, (a << 24) | (b << 16) | (c << 8) | d, len, rng);
+    i += used;
+  }
+  return true;
+}
+
+// unicast prefixes with lengths weighted roughly like a full BGP table, about
+// half of them /24
+static void generatePrefixes(size_t count, std::vector<Prefix> &prefixes, std::mt19937 &rng) {
+  static const int lengths[] = {8, 12, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24};
+  static const double weights[] = {1, 3, 5, 5, 30, 15, 25, 40, 70, 70, 120, 110, 500};
+  std::discrete_distribution<int> pick(weights, weights + sizeof(weights) / sizeof(weights[0]));
+  std::unordered_set<uint64_t> seen;
+  while (prefixes.size() < count) {
+    uint32_t key = (1 + rng() % 223) << 24 | (rng() & 0xffffff);
+    addPrefix(prefixes, seen, key, lengths[pick(rng)], rng);
+  }
+}
+
+enum Workload { RANDOM, UNIFORM, SEQUENTIAL, ZIPF, WORKLOADS };
+const char *workloadNames[WORKLOADS] = {"random", "uniform", "sequential", "zipf"};
+
+// random: anywhere in the address space, mostly misses. uniform: inside a
+// prefix picked uniformly. sequential: 16 consecutive addresses in each
+// prefix, in address order. zipf: inside a prefix picked by a Zipf(1)
+// popularity over a random ranking.
+static std::vector<uint32_t> makeWorkload(int kind, const std::vector<Prefix> &prefixes,
+                                          size_t n, std::mt19937 &rng) {
+  std::vector<uint32_t> keys(n);
+  std::vector<Prefix> order(prefixes);
+  std::vector<double> cdf;
+  if (kind == SEQUENTIAL) {
+    std::sort(order.begin(), order.end(),
+              [](const Prefix &a, const Prefix &b) { return a.key < b.key; });
+  } else if (kind == ZIPF) {
+    std::shuffle(order.begin(), order.end(), rng);
+    double sum = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+      sum += 1.0 / (i + 1);
+      cdf.push_back(sum);
+    }
+  }
+  std::uniform_real_distribution<double> unit(0, 1);
+  for (size_t i = 0; i < n; i++) {
+    if (kind == RANDOM) {
+      keys[i] = rng();
+      continue;
+    }
+    const Prefix *p;
+    uint32_t host = rng();
+    if (kind == UNIFORM) {
+      p = &order[rng() % order.size()];
+    } else if (kind == SEQUENTIAL) {
+      p = &order[(i / 16) % order.size()];
+      host = i % 16;
+    } else {
+      size_t rank = std::lower_bound(cdf.begin(), cdf.end(), unit(rng) * cdf.back()) - cdf.begin();
+      p = &order[std::min(rank, order.size() - 1)];
+    }
+    keys[i] = p->key | (host & ~prefixMask(p->len));
+  }
+  return keys;
+}
+
+struct Phase {
+  const char *name;
+  // queries of every workload, then both ends of every prefix
+  std::vector<uint16_t> expected;
+};
+
+static std::vector<uint32_t> checkKeys;
+// keeps the timed lookups from being optimized away
+volatile uint32_t lookupSink;
+static std::vector<uint32_t> workloads[WORKLOADS];
+
+template <class Engine>
+static size_t check(const Engine &engine, const char *engineName, const Phase &phase) {
+  size_t mismatches = 0;
+  for (size_t i = 0; i < checkKeys.size(); i++) {
+    uint16_t got = engine.lookup(checkKeys[i]);
+    if (got == phase.expected[i]) continue;
+    if (mismatches++ < 5) {
+      uint32_t key = checkKeys[i];
+      fprintf(stderr, "%s after %s: %u.%u.%u.%u gives %u, expected %u\n", engineName, phase.name,
+              key >> 24, (key >> 16) & 0xff, (key >> 8) & 0xff, key & 0xff, got, phase.expected[i]);
+    }
+  }
+  return mismatches;
+}
+
+template <class Engine>
+static size_t run(const char *name, const std::vector<Prefix> &prefixes,
+                  const std::vector<Prefix> &removed, const std::vector<Prefix> &readded,
+                  const Phase *phases) {
+  Engine *engine = new Engine();
+  auto begin = std::chrono::steady_clock::now();
+  engine->begin();
+  for (size_t i = 0; i < prefixes.size(); i++) engine->insert(prefixes[i]);
+  engine->commit();
+  double build = seconds(begin);
+  size_t memory = engine->memory();
+
+  double rates[WORKLOADS];
+  uint32_t sink = 0;
+  for (int w = 0; w < WORKLOADS; w++) {
+    const std::vector<uint32_t> &keys = workloads[w];
+    begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) sink += engine->lookup(keys[i]);
+    rates[w] = keys.size() / seconds(begin);
+  }
+  lookupSink = sink;
+  size_t mismatches = check(*engine, name, phases[0]);
+
+  begin = std::chrono::steady_clock::now();
+  engine->begin();
+  for (size_t i = 0; i < removed.size(); i++) engine->remove(removed[i]);
+  engine->commit();
+  double removal = seconds(begin);
+  mismatches += check(*engine, name, phases[1]);
+
+  begin = std::chrono::steady_clock::now();
+  engine->begin();
+  for (size_t i = 0; i < readded.size(); i++) engine->insert(readded[i]);
+  engine->commit();
+  double readd = seconds(begin);
+  mismatches += check(*engine, name, phases[2]);
+  delete engine;
+
+  printf("%-8s %9.1f %10.0f %10.0f %10.0f", name, build * 1e3, prefixes.size() / build,
+         removed.size() / removal, readded.size() / readd);
+  if (memory) printf(" %9.1f", (double)memory / prefixes.size());
+  else printf(" %9s", "-");
+  for (int w = 0; w < WORKLOADS; w++) printf(" %10.2f", rates[w] / 1e6);
+  printf("  %s\n", mismatches ? "MISMATCH" : "ok");
+  return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+  size_t queries = 1 << 20;
+  size_t synthetic = 0;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:r:")) != -1) {
+    if (opt == 'n') queries = strtoul(optarg, NULL, 0);
+    else if (opt == 's') synthetic = strtoul(optarg, NULL, 0);
+    else if (opt == 'r') seed = strtoul(optarg, NULL, 0);
+    else {
+      fprintf(stderr, "usage: %s [-n queries] [-r seed] (-s count | prefix_file)\n", argv[0]);
+      return 2;
+    }
+  }
+  std::mt19937 rng(seed);
+  std::vector<Prefix> prefixes;
+  if (synthetic) {
+    generatePrefixes(synthetic, prefixes, rng);
+  } else if (optind < argc) {
+    if (!loadPrefixes(argv[optind], prefixes, rng)) {
+      perror(argv[optind]);
+      return 2;
+    }
+  } else {
+    generatePrefixes(100000, prefixes, rng);
+  }
+  if (prefixes.empty() || queries == 0) {
+    fprintf(stderr, "nothing to look up\n");
+    return 2;
+  }
+
+  // withdraw every other prefix in random order, then re-install those left
+  // with new next hops
+  std::vector<Prefix> shuffled(prefixes);
+  std::shuffle(shuffled.begin(), shuffled.end(), rng);
+  std::vector<Prefix> removed, kept;
+  for (size_t i = 0; i < shuffled.size(); i++) (i % 2 ? kept : removed).push_back(shuffled[i]);
+  std::vector<Prefix> readded(kept);
+  for (size_t i = 0; i < readded.size(); i++) readded[i].adj = 1 + readded[i].adj % ADJACENCIES;
+
+  for (int w = 0; w < WORKLOADS; w++) {
+    workloads[w] = makeWorkload(w, prefixes, queries, rng);
+    checkKeys.insert(checkKeys.end(), workloads[w].begin(), workloads[w].end());
+  }
+  for (size_t i = 0; i < prefixes.size(); i++) {
+    checkKeys.push_back(prefixes[i].key);
+    checkKeys.push_back(prefixes[i].key | ~prefixMask(prefixes[i].len));
+  }
+
+  Phase phases[3] = {{"insert", {}}, {"remove", {}}, {"re-insert", {}}};
+  Reference reference;
+  for (size_t i = 0; i < prefixes.size(); i++)
+    reference.insert(prefixes[i].key, prefixes[i].len, prefixes[i].adj);
+  for (int phase = 0; phase < 3; phase++) {
+    if (phase == 1)
+      for (size_t i = 0; i < removed.size(); i++) reference.remove(removed[i].key, removed[i].len);
+    if (phase == 2)
+      for (size_t i = 0; i < readded.size(); i++)
+        reference.insert(readded[i].key, readded[i].len, readded[i].adj);
+    phases[phase].expected.resize(checkKeys.size());
+    for (size_t i = 0; i < checkKeys.size(); i++)
+      phases[phase].expected[i] = reference.lookup(checkKeys[i]);
+  }
+
+  printf("%zu prefixes, %zu queries per workload, lookups in millions per second\n",
+         prefixes.size(), queries);
+  printf("%-8s %9s %10s %10s %10s %9s", "engine", "build ms", "insert/s", "remove/s",
+         "update/s", "B/prefix");
+  for (int w = 0; w < WORKLOADS; w++) printf(" %10s", workloadNames[w]);
+  printf("\n");
+
+  size_t mismatches = 0;
+  mismatches += run<DirectEngine<MultibitTrie> >("trie", prefixes, removed, readded, phases);
+  mismatches += run<DirectEngine<Dir24_8> >("dir24_8", prefixes, removed, readded, phases);
+  mismatches += run<RibEngine>("rib", prefixes, removed, readded, phases);
+  return mismatches ? 1 : 0;
+}
@@ -1,36 +1,261 @@
+#include "checksum.h"
+#include "datapath.h"
+#include "logger.h"
 #include "rip.h"
 #include "router.h"
 #include "router_hal.h"
+#include "spsc_ring.h"
+#include "timer_wheel.h"
+#include "update_cache.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-extern bool validateIPChecksum(uint8_t *packet, size_t len);
 extern void update(bool insert, RoutingTableEntry entry);
-extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
-extern bool forward(uint8_t *packet, size_t len);
-extern bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output);
 extern uint32_t assemble(const RipPacket *rip, uint8_t *buffer);
-extern void update(RoutingTableEntry entry);
-extern void response(RipPacket *resp, uint32_t if_index);
-extern void response(RipPacket *resp, uint32_t if_index, int table_index);
+extern void beginUpdate();
+extern void commitUpdate();
 extern void printTable();
 extern int getRoutingTableSize();
+extern int takeChangedRoutes();
+extern void changedResponse(RipPacket *resp, uint32_t if_index, uint32_t *next);
+extern UpdateCache updateCache;
 
-uint32_t addWhile(uint32_t a, uint32_t b);
 int format_packet(in_addr_t src_addr, in_addr_t dst_addr, RipPacket *resp, uint8_t* buffer);
 void setSrcAddr(in_addr_t src_addr, uint8_t *buffer);
 
-uint8_t packet[2048];
-uint8_t output[2048];
+#define RX_BURST 32
+
 in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0203a8c0, 0x0104a8c0, 0x0100000a, 0x0101000a};
 in_addr_t multicast_addr = {0x090000e0};
 
+// packets the control thread can have waiting to be sent
+#define OUTBOUND_RING_SIZE 1024
+
+typedef SpscRing<ControlPacket, OUTBOUND_RING_SIZE> OutboundRing;
+
+// packets addressed to the router, one ring from each forwarding worker to
+// the control thread. The control thread sleeps on controlReady only after
+// setting controlSleeping and finding every ring empty, so a worker has to
+// take the lock and notify only when it sees controlSleeping set.
+ControlRing controlRings[HAL_MAX_WORKERS];
+int workerCount = 1;
+std::mutex controlLock;
+std::condition_variable controlReady;
+std::atomic<bool> controlSleeping(false);
+// packets built by the control thread, sent by the first forwarding worker so
+// that the control thread never touches the HAL queues. The control thread
+// wakes the worker with HAL_WakeWorker; when the ring is full it sleeps on
+// outboundRoom, notified by the worker only if outboundWaiting is set.
+OutboundRing outboundRing;
+std::condition_variable outboundRoom;
+std::atomic<bool> outboundWaiting(false);
+
+// control thread timers: the periodic and triggered updates here, route
+// timeouts in the RIB
+TimerWheel timers;
+uint32_t triggeredTimer;
+
+std::atomic<bool> stopping(false);
+std::atomic<int> exitCode(0);
+
+void stop(int code) {
+  exitCode = code;
+  stopping = true;
+  for (int i = 0; i < workerCount; i++)
+    HAL_WakeWorker(i);
+  std::lock_guard<std::mutex> lock(controlLock);
+  controlReady.notify_one();
+  outboundRoom.notify_one();
+}
+
+// sleeps until the first worker has taken packets off the outbound ring or
+// the router stops
+void waitForOutbound() {
+  std::unique_lock<std::mutex> lock(controlLock);
+  outboundWaiting.store(true, std::memory_order_relaxed);
+  // pairs with the fence in flushOutbound
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (outboundRing.back() == NULL && !stopping) outboundRoom.wait(lock);
+  outboundWaiting.store(false, std::memory_order_relaxed);
+}
+
+void sendFromControl(int if_index, const uint8_t *buffer, size_t length, const macaddr_t dst_mac) {
+  if (length > CONTROL_PACKET_MTU) return;
+  ControlPacket *out;
+  while ((out = outboundRing.back()) == NULL) {
+    if (stopping) return;
+    waitForOutbound();
+  }
+  memcpy(out->data, buffer, length);
+  out->length = length;
+  out->if_index = if_index;
+  memcpy(out->mac, dst_mac, sizeof(macaddr_t));
+  outboundRing.push();
+  // a no-op until the worker has woken up from the last one
+  HAL_WakeWorker(0);
+}
+
+void flushOutbound() {
+  bool flushed = false;
+  for (ControlPacket *out; (out = outboundRing.front()) != NULL; outboundRing.pop()) {
+    HAL_SendIPPacket(out->if_index, out->data, out->length, out->mac);
+    flushed = true;
+  }
+  if (!flushed) return;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (outboundWaiting.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(controlLock);
+    outboundRoom.notify_one();
+  }
+}
+
+// wakes the control thread if it may have gone to sleep before the packets
+// just queued for it; once per burst, and only a load unless it sleeps
+void notifyControl() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (controlSleeping.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(controlLock);
+    controlReady.notify_one();
+  }
+}
+
+// sleeps until a worker queues a packet for the control thread, timeout ms
+// pass (-1 for no limit) or the router stops
+void waitForControl(int64_t timeout) {
+  std::unique_lock<std::mutex> lock(controlLock);
+  controlSleeping.store(true, std::memory_order_relaxed);
+  // pairs with the fence in notifyControl: either the worker sees
+  // controlSleeping, or its packet is seen here
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool pending = false;
+  for (int i = 0; i < workerCount; i++)
+    pending = pending || !controlRings[i].empty();
+  if (!pending && !stopping) {
+    if (timeout < 0) controlReady.wait(lock);
+    else controlReady.wait_for(lock, std::chrono::milliseconds(timeout));
+  }
+  controlSleeping.store(false, std::memory_order_relaxed);
+}
+
+// one per forwarding worker: the HAL hands each worker the flows hashed to it
+// on every interface, and the worker forwards them in order through its own
+// transmit queues. All workers read the same FIB.
+void forwardLoop(int worker) {
+  HAL_BindWorker(worker);
+  ControlRing &control = controlRings[worker];
+  HAL_Frame frames[RX_BURST];
+  while (!stopping) {
+    if (worker == 0) flushOutbound();
+
+    int mask = (1 << N_IFACE_ON_BOARD) - 1;
+    // returns early when the control thread has queued packets or the router
+    // stops, see sendFromControl and stop
+    int res = HAL_ReceiveFrames(mask, frames, RX_BURST, -1);
+
+    if (res == HAL_ERR_EOF) { stop(0); break; }
+    else if (res < 0) { stop(res); break; }
+
+    bool queued = false;
+    for (int i = 0; i < res; i++)
+      queued |= processFrame(frames[i], control);
+    HAL_FlushIPPackets(-1);
+    if (queued) notifyControl();
+  }
+}
+
+// RFC 2453 3.10.1: changed routes go out after a random 1-5 s hold-down, so
+// that a burst of changes is sent as one train and neighbours do not update
+// in lockstep
+void scheduleTriggeredUpdate() {
+  if (!timers.armed(triggeredTimer))
+    timers.arm(triggeredTimer, timers.now() + 1000 + rand() % 4001);
+}
+
+// the triggered update: only the changed routes, on every interface
+void triggeredUpdate(uint32_t, void *) {
+  uint8_t buffer[2048];
+  int changed = takeChangedRoutes();
+  if (changed == 0) return;
+  LOG_INFO("\nTriggered update of %d routes\n", changed);
+  for(int i=0; i<N_IFACE_ON_BOARD; i++){
+    uint32_t next = 0;
+    while (next < (uint32_t)changed) {
+      RipPacket resp;
+      macaddr_t dest_mac;
+      changedResponse(&resp, i, &next);
+      int rip_len = format_packet(addrs[i], multicast_addr, &resp, buffer);
+      HAL_ArpGetMacAddress(i, multicast_addr, dest_mac);
+      sendFromControl(i, buffer, rip_len + 20 + 8, dest_mac);
+    }
+  }
+}
+
+// per interface counters from the HAL, summed over the forwarding workers
+void printStats() {
+  static const char *dropNames[HAL_DROP_REASONS] = {"checksum", "no route", "arp", "ttl", "rip", "oversize", "no buffer"};
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    HAL_Stats stats;
+    if (HAL_GetStats(i, &stats) != 0) return;
+    LOG_INFO("\nInterface %d: rx %llu packets %llu bytes, tx %llu packets %llu bytes, dropped", i,
+             (unsigned long long)stats.rx_packets, (unsigned long long)stats.rx_bytes,
+             (unsigned long long)stats.tx_packets, (unsigned long long)stats.tx_bytes);
+    for (int j = 0; j < HAL_DROP_REASONS; j++)
+      LOG_INFO(" %s %llu", dropNames[j], (unsigned long long)stats.drops[j]);
+  }
+}
+
+// the periodic update: every route, on every interface
+void periodicUpdate(uint32_t timer, void *) {
+  // pending changes go out with everything else
+  takeChangedRoutes();
+  timers.cancel(triggeredTimer);
+  LOG_INFO("\n5s Timer\n");
+  LOG_INFO("Routing Table Size Is %d", getRoutingTableSize());
+  for(int i=0; i<N_IFACE_ON_BOARD; i++){
+    macaddr_t dest_mac;
+    HAL_ArpGetMacAddress(i, multicast_addr, dest_mac);
+    for (uint32_t k = 0; k < updateCache.packetCount(); k++) {
+      size_t length;
+      const uint8_t *packet = updateCache.packet(i, k, &length);
+      sendFromControl(i, packet, length, dest_mac);
+    }
+  }
+  printTable();
+  printStats();
+  LOG_INFO("\n");
+  timers.arm(timer, timers.now() + 5 * 1000);
+}
+
 int main(int argc, char *argv[]) {
-  int res = HAL_Init(1, addrs);
+  // forwarding workers: the first argument, or one per core left over by the
+  // control thread and at most one per port
+  int workers = (int)std::thread::hardware_concurrency() - 1;
+  if (workers > N_IFACE_ON_BOARD) workers = N_IFACE_ON_BOARD;
+  if (argc > 1) workers = atoi(argv[1]);
+  if (workers < 1) workers = 1;
+  if (HAL_SetWorkerCount(workers) != 0) {
+    LOG_WARN("%d forwarding workers not supported, using 1\n", workers);
+    workers = 1;
+  }
+  // the HAL writes to stderr at once, from the forwarding workers too, so its
+  // debug output comes with debug logging only
+  int res = HAL_Init(LOG_LEVEL <= LOG_LEVEL_DEBUG, addrs);
   if (res < 0) return res;
+  // from here on the forwarding workers never wait for stdout
+  logStart();
+  srand(HAL_GetTicks() ^ addrs[0]);
+  updateCache.setAddresses(addrs);
+  timers.advance(HAL_GetTicks());
+  triggeredTimer = timers.create(triggeredUpdate, NULL);
   for (uint32_t i = 0; i < N_IFACE_ON_BOARD; i++) {
     RoutingTableEntry entry = {
         .addr = addrs[i] & 0x00ffffff,
@@ -42,104 +267,37 @@ int main(int argc, char *argv[]) {
     update(true, entry);
   }
 
-  uint64_t last_time = 0;
-  while (1) {
-    uint64_t time = HAL_GetTicks();
-    if (time > last_time + 5 * 1000) {
-      printf("\n5s Timer\n");
-      printf("Routing Table Size Is %u", getRoutingTableSize());
-      for(int i=0; i<N_IFACE_ON_BOARD; i++){
-        for(int j=0; j<getRoutingTableSize(); j+=25){
-          RipPacket resp;
-          macaddr_t dest_mac;
-          response(&resp, i, j);
-          int rip_len = format_packet(addrs[i], multicast_addr, &resp, output);
-          HAL_ArpGetMacAddress(i, multicast_addr, dest_mac);
-          HAL_SendIPPacket(i, output, rip_len + 20 + 8, dest_mac);
-        }
-      }
-      printTable();
-      last_time = time;
-      printf("\n");
-    }
+  workerCount = workers;
+  std::vector<std::thread> forwarders;
+  for (int i = 0; i < workers; i++)
+    forwarders.push_back(std::thread(forwardLoop, i));
 
-    int mask = (1 << N_IFACE_ON_BOARD) - 1;
-    macaddr_t src_mac;
-    macaddr_t dst_mac;
-    int if_index;
-    res = HAL_ReceiveIPPacket(mask, packet, sizeof(packet), src_mac, dst_mac, 1000, &if_index);
-
-    if (res == HAL_ERR_EOF) { break; }
-    else if (res < 0) { return res; }
-    else if (res == 0) { continue; }
-    else if (res > sizeof(packet)) { continue; }
-
-    if (!validateIPChecksum(packet, res)) {
-      printf("Invalid IP Checksum\n");
-      continue;
-    }
-
-    in_addr_t src_addr, dst_addr;
-    src_addr = 0x00000000;
-    dst_addr = 0x00000000;
-    for(int offset = 12;offset < 16;offset ++){
-      src_addr += (packet[offset] << ((offset - 12) * 8));
-      dst_addr += (packet[offset+4] << ((offset - 12)* 8));
-    }
+  // control plane: RIP processing and timers, it sleeps until a packet
+  // arrives or the next timer is due
+  uint32_t periodic = timers.create(periodicUpdate, NULL);
+  timers.arm(periodic, timers.now());
+  while (!stopping) {
+    waitForControl(timers.timeout(HAL_GetTicks()));
 
-    bool dst_is_me = false;
-    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
-      if (memcmp(&dst_addr, &addrs[i], sizeof(in_addr_t)) == 0) { dst_is_me = true; break; }
-    }
-    dst_is_me = dst_is_me || memcmp(&dst_addr, &multicast_addr, sizeof(in_addr_t)) == 0 ;
-
-    if (dst_is_me) {
-      if(((packet[20] << 8) + packet[21] != 520) || ((packet[22] << 8) + packet[23] != 520)) continue;
-      RipPacket rip;
-      if (disassemble(packet, res, &rip)) {
-        bool wrong_metric = false;
-        if (rip.command != 1) {
-          printf("\n*** Get Response Packet From %08x ***\n", src_addr);
-          int invalidNum = 0;
-          for(int i=0;i<rip.numEntries;i++){
-            uint32_t correct_mask = ntohl(rip.entries[i].mask);
-            uint32_t len = 0;
-            while(correct_mask << len !=  0) { len ++; }
-            RoutingTableEntry routingTableEntry = {
-              .addr = rip.entries[i].addr,
-              .len = len,
-              .if_index = (uint32_t)if_index,
-              .nexthop = src_addr,
-              .metric = rip.entries[i].metric+1
-            };
-            if(rip.entries[i].metric + 1 < 16) update(routingTableEntry);
-          }
-        }
+    // timers are armed relative to the wheel, bring it up to date first;
+    // routes timed out together reach the FIB in one batch
+    beginUpdate();
+    timers.advance(HAL_GetTicks());
+    commitUpdate();
+    // at most a ring's worth from each worker, so that timers are not held
+    // up by a steady stream
+    for (int i = 0; i < workers; i++) {
+      ControlPacket *in;
+      for (int n = 0; n < CONTROL_RING_SIZE && (in = controlRings[i].front()) != NULL; n++) {
+        handleRip(in->data, in->length, in->if_index);
+        controlRings[i].pop();
       }
-    } else { // !dst_is_me
-      printf("\n*** Get Forward Packet From %08x To %08x ***\n", src_addr, dst_addr);
-      uint32_t nexthop, dest_if;
-
-      if (query(dst_addr, &nexthop, &dest_if)) {
-        printf("Found\n");
-        macaddr_t dest_mac;
-        if (nexthop == 0) nexthop = dst_addr;
-        if (HAL_ArpGetMacAddress(dest_if, nexthop, dest_mac) == 0) {
-          memcpy(output, packet, res);
-          forward(output, res);
-          if(output[8] == 0) continue;
-          HAL_SendIPPacket(dest_if, output, res, dest_mac);
-        } else printf("ARP not found for %x\n", nexthop);
-      } else printf("IP not found for %x\n", src_addr);
     }
   }
-  return 0;
-}
-
-uint32_t addWhile(uint32_t a, uint32_t b){
-  int res = a+b;
-  while(res  >= 65536) res = (res & 0xFFFF) + (res >> 16);
-  return res;
+  for (size_t i = 0; i < forwarders.size(); i++)
+    forwarders[i].join();
+  logStop();
+  return exitCode;
 }
 
 int format_packet(in_addr_t src_addr, in_addr_t dst_addr, RipPacket *resp, uint8_t* buffer){
@@ -165,11 +323,12 @@ int format_packet(in_addr_t src_addr, in_addr_t dst_addr, RipPacket *resp, uint8
   uint32_t udp_len = rip_len + 8;
   buffer[24] = (udp_len & 0xff00) >> 8;
   buffer[25] = udp_len & 0xff;
-  uint32_t checksum = 0x0000;
-  for(int offset = 0 ; offset< 20 ; offset+=2) checksum = addWhile(checksum, (unsigned)(buffer[offset] << 8)+buffer[offset+1]);
-  checksum = (~checksum) & 0xffff;
+  uint16_t checksum = internetChecksum(buffer, 20);
   buffer[10] = (checksum & 0xff00) >> 8;
   buffer[11] = checksum & 0xff;
+  checksum = udpChecksum(buffer, ip_total_len);
+  buffer[26] = (checksum & 0xff00) >> 8;
+  buffer[27] = checksum & 0xff;
   return rip_len;
 }
 
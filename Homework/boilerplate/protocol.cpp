@@ -1,70 +1,57 @@
 #include "rip.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 
 uint32_t assemble(const RipPacket *rip, uint8_t *buffer) {
-  int offset = 0;
-  buffer[offset++] = (*rip).command;
-  buffer[offset++] = 0x2;
-  buffer[offset++] = 0;
-  buffer[offset++] = 0;
-  for(int i = 0 ; i < (*rip).numEntries ; i++){
-    buffer[offset++] = 0;
-    if((*rip).command == 2) buffer[offset++] = 2;
-    else buffer[offset++] = 0;
-    buffer[offset++] = 0;
-    buffer[offset++] = 0;
-    auto getEntry = (*rip).entries[i];
-    for(int period = 0 ; period < 4 ; period++ ) buffer[offset+period] = getEntry.addr >> (period * 8);
-    offset += 4;
-    for(int period = 0 ; period < 4 ; period++ ) buffer[offset+period] = getEntry.mask >> (period * 8);
-    offset += 4;
-    for(int period = 0 ; period < 4 ; period++ ) buffer[offset+period] = getEntry.nexthop >> (period * 8);
-    offset += 4;
-    for(int period = 0 ; period < 4 ; period++ ) buffer[offset+period] = getEntry.metric >> ((3 - period) * 8);
-    offset += 4;
+  buffer[0] = rip->command;
+  buffer[1] = 0x2;
+  buffer[2] = 0;
+  buffer[3] = 0;
+  uint8_t *at = buffer + 4;
+  for (uint32_t i = 0; i < rip->numEntries; i++, at += RIP_ENTRY_SIZE) {
+    const RipEntry &entry = rip->entries[i];
+    // address family 2 in responses, 0 in a request for the whole table
+    at[0] = 0;
+    at[1] = rip->command == 2 ? 2 : 0;
+    at[2] = 0;
+    at[3] = 0;
+    uint32_t metric = htonl(entry.metric);
+    memcpy(at + 4, &entry.addr, 4);
+    memcpy(at + 8, &entry.mask, 4);
+    memcpy(at + 12, &entry.nexthop, 4);
+    memcpy(at + 16, &metric, 4);
   }
-  return offset;
+  return at - buffer;
 }
 
-bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output) {
-  int offset = 28;
-  int command = packet[offset++];
-  int version = packet[offset++];
-  int zero_0 = packet[offset++];
-  int zero_1 = packet[offset++];
-  (*output).numEntries = 0;
-  if ((command != 1 && command != 2) || (version != 2) || (zero_0 != 0 || zero_1 != 0)) return false;
-  else {
-    for(int i=0 ; offset < len - 1 ; i++){
-      int family = (packet[offset++] << 8) + packet[offset++];
-      int tag = (packet[offset++] << 8) + packet[offset++];
-      if((command == 2 && family != 2) || (command == 1 && family != 0) || (tag != 0)) return false;
-      RipEntry& getEntry = ((*output).entries[i]);
-      getEntry.addr = (packet[offset]) + (packet[offset+1] << 8) + (packet[offset+2] << 16) + (packet[offset+3] << 24);
-      offset += 4;
-      getEntry.mask =  (packet[offset]) + (packet[offset+1] << 8) + (packet[offset+2] << 16) + (packet[offset+3] << 24);
-      offset += 4;
-      int checkingMask = getEntry.mask + 1;
-      bool correctness = false;
-      for(int j = 0;j<31;j++){
-        if((1 << j) == checkingMask){
-          correctness = true;
-          break;
-        }
-      }
-      if(!correctness) return false;
-      getEntry.nexthop =  (packet[offset]) + (packet[offset+1] << 8) + (packet[offset+2] << 16) + (packet[offset+3] << 24);
-      offset += 4;
-      getEntry.metric =  (packet[offset] << 24) + (packet[offset+1] << 16) + (packet[offset+2] << 8) + (packet[offset+3]);
-      offset += 4;
-      if(getEntry.metric < 1 || getEntry.metric > 16) return false;
-      (*output).numEntries ++;
-    }
-    (*output).command = command;
-    if(offset > len) return false;
-    else return true;
+bool RipView::parse(const uint8_t *packet, uint32_t len) {
+  if (len < 20) return false;
+  // IP: the header length from IHL, UDP to and from port 520
+  uint32_t ip_header = (packet[0] & 0xf) * 4;
+  if (ip_header < 20 || packet[9] != 17 || len < ip_header + 8 + 4) return false;
+  const uint8_t *udp = packet + ip_header;
+  if (((udp[0] << 8) | udp[1]) != 520 || ((udp[2] << 8) | udp[3]) != 520) return false;
+  uint32_t udp_len = (udp[4] << 8) | udp[5];
+  if (udp_len < 8 + 4 || udp_len > len - ip_header) return false;
+  uint32_t rip_len = udp_len - 8;
+  if ((rip_len - 4) % RIP_ENTRY_SIZE != 0 || (rip_len - 4) / RIP_ENTRY_SIZE > RIP_MAX_ENTRY) return false;
+
+  // RIP header: command, version 2, two zero bytes
+  const uint8_t *rip = udp + 8;
+  uint8_t command = rip[0];
+  if ((command != 1 && command != 2) || rip[1] != 2 || rip[2] != 0 || rip[3] != 0) return false;
+  header = rip;
+  finish = rip + rip_len;
+  for (const uint8_t *at = rip + 4; at < finish; at += RIP_ENTRY_SIZE) {
+    // family 2 in responses and 0 in requests, route tag 0
+    uint16_t family = (at[0] << 8) | at[1];
+    if (family != (command == 2 ? 2 : 0) || at[2] != 0 || at[3] != 0) return false;
+    RipEntry entry = *Iterator(at);
+    if (!isContiguousMask(entry.mask)) return false;
+    if (entry.metric < 1 || entry.metric > 16) return false;
   }
+  return true;
 }
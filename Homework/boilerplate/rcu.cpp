@@ -0,0 +1,65 @@
+#include "rcu.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+struct alignas(64) RcuReader {
+  // epoch observed on entering the read side, 0 while quiescent
+  std::atomic<uint64_t> epoch;
+  std::atomic<bool> used;
+};
+
+static RcuReader readers[RCU_MAX_READERS];
+static std::atomic<uint64_t> globalEpoch(1);
+
+// gives the reader slot back when its thread exits
+struct RcuThreadSlot {
+  RcuReader *reader;
+  int depth;
+  ~RcuThreadSlot() {
+    if (reader) reader->used.store(false, std::memory_order_release);
+  }
+};
+
+static thread_local RcuThreadSlot self = {NULL, 0};
+
+static RcuReader *registerReader() {
+  for (int i = 0; i < RCU_MAX_READERS; i++) {
+    bool expected = false;
+    if (readers[i].used.compare_exchange_strong(expected, true)) {
+      readers[i].epoch.store(0);
+      return &readers[i];
+    }
+  }
+  fprintf(stderr, "rcu: more than %d reader threads\n", RCU_MAX_READERS);
+  abort();
+}
+
+void rcuReadLock() {
+  if (self.depth++ > 0) return;
+  if (!self.reader) self.reader = registerReader();
+  // seq_cst so that the writer either sees this epoch or we see its update
+  self.reader->epoch.store(globalEpoch.load());
+}
+
+void rcuReadUnlock() {
+  if (--self.depth > 0) return;
+  self.reader->epoch.store(0, std::memory_order_release);
+}
+
+uint64_t rcuRetire() { return globalEpoch.fetch_add(1); }
+
+bool rcuQuiescent(uint64_t token) {
+  for (int i = 0; i < RCU_MAX_READERS; i++) {
+    uint64_t e = readers[i].epoch.load();
+    if (e != 0 && e <= token) return false;
+  }
+  return true;
+}
+
+void rcuWait(uint64_t token) {
+  while (!rcuQuiescent(token)) {
+    std::this_thread::yield();
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef __RCU_H__
+#define __RCU_H__
+
+#include <stdint.h>
+
+// Epoch based read-copy-update.
+//
+// Readers bracket every access to published data with rcuReadLock() and
+// rcuReadUnlock(); these never block and may nest. A writer that unpublishes
+// something calls rcuRetire() to get a token, and may reuse or free the old
+// data once rcuQuiescent(token) holds, i.e. every reader that could still
+// see it has left its read-side critical section.
+
+#define RCU_MAX_READERS 64
+
+void rcuReadLock();
+void rcuReadUnlock();
+
+uint64_t rcuRetire();
+bool rcuQuiescent(uint64_t token);
+// block until rcuQuiescent(token)
+void rcuWait(uint64_t token);
+
+class RcuReadGuard {
+public:
+  RcuReadGuard() { rcuReadLock(); }
+  ~RcuReadGuard() { rcuReadUnlock(); }
+  RcuReadGuard(const RcuReadGuard &) = delete;
+  RcuReadGuard &operator=(const RcuReadGuard &) = delete;
+};
+
+#endif
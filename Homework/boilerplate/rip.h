@@ -1,5 +1,11 @@
+#ifndef __RIP_H__
+#define __RIP_H__
+
 #include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
 #define RIP_MAX_ENTRY 25
+#define RIP_ENTRY_SIZE 20
 
 typedef struct {
   uint32_t addr;
@@ -13,3 +19,62 @@ typedef struct {
   uint8_t command;
   RipEntry entries[RIP_MAX_ENTRY];
 } RipPacket;
+
+// A RIPv2 message read in place from the IPv4 packet carrying it. parse()
+// checks the IP and UDP headers and every entry, after which the entries are
+// decoded from the packet bytes one at a time while iterating. Addresses and
+// masks stay in network byte order as in RipEntry.
+class RipView {
+public:
+  class Iterator {
+  public:
+    explicit Iterator(const uint8_t *at) : at(at) {}
+    RipEntry operator*() const {
+      RipEntry entry;
+      memcpy(&entry.addr, at + 4, 4);
+      memcpy(&entry.mask, at + 8, 4);
+      memcpy(&entry.nexthop, at + 12, 4);
+      memcpy(&entry.metric, at + 16, 4);
+      entry.metric = ntohl(entry.metric);
+      return entry;
+    }
+    Iterator &operator++() {
+      at += RIP_ENTRY_SIZE;
+      return *this;
+    }
+    bool operator!=(const Iterator &other) const { return at != other.at; }
+
+  private:
+    const uint8_t *at;
+  };
+
+  RipView() : header(NULL), finish(NULL) {}
+
+  // true if packet holds a well formed RIPv2 request or response of at most
+  // RIP_MAX_ENTRY entries; the view reads from packet, which must outlive it
+  bool parse(const uint8_t *packet, uint32_t len);
+
+  uint8_t command() const { return header[0]; }
+  uint32_t size() const { return (finish - header - 4) / RIP_ENTRY_SIZE; }
+  Iterator begin() const { return Iterator(header + 4); }
+  Iterator end() const { return Iterator(finish); }
+
+private:
+  // the RIP header, and the end of the last entry
+  const uint8_t *header;
+  const uint8_t *finish;
+};
+
+// a contiguous mask has all ones above its lowest set bit: its inverse is a
+// run of low ones, which plus one carries into no bit of it
+static inline bool isContiguousMask(uint32_t mask) {
+  uint32_t inverse = ~ntohl(mask);
+  return (inverse & (inverse + 1)) == 0;
+}
+
+// prefix length of a contiguous mask, in either byte order
+static inline uint32_t maskToLen(uint32_t mask) {
+  return __builtin_popcount(mask);
+}
+
+#endif
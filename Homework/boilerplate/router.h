@@ -1,3 +1,6 @@
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
 #include <stdint.h>
 
 typedef struct {
@@ -7,3 +10,5 @@ typedef struct {
     uint32_t nexthop;
     uint32_t metric;
 } RoutingTableEntry;
+
+#endif
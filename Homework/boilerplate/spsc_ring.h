@@ -0,0 +1,62 @@
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded queue from exactly one producer thread to one consumer thread,
+// without locks.
+//
+// Slots are filled and read in place: the producer writes the slot returned
+// by back() and publishes it with push(), the consumer reads front() and
+// gives it back with pop(). Each side keeps its index on a cache line of its
+// own together with the last index it saw of the other side, and only reads
+// the other side's line when that says the ring is full or empty. N is a
+// power of two; slots are not constructed or destroyed as they are used.
+template <typename T, uint32_t N> class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be a power of two");
+
+public:
+  SpscRing() : head(0), tailSeen(0), tail(0), headSeen(0) {}
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // producer: the next slot to fill, NULL if the ring is full
+  T *back() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tailSeen == N) {
+      tailSeen = tail.load(std::memory_order_acquire);
+      if (h - tailSeen == N) return NULL;
+    }
+    return &slots[h & (N - 1)];
+  }
+  // producer: hands the slot from back() to the consumer
+  void push() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // consumer: the oldest filled slot, NULL if the ring is empty
+  T *front() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == headSeen) {
+      headSeen = head.load(std::memory_order_acquire);
+      if (t == headSeen) return NULL;
+    }
+    return &slots[t & (N - 1)];
+  }
+  // consumer: gives the slot from front() back to the producer
+  void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // whether anything is waiting, from either side or a third thread
+  bool empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+private:
+  T slots[N];
+  alignas(64) std::atomic<uint32_t> head;
+  uint32_t tailSeen;
+  alignas(64) std::atomic<uint32_t> tail;
+  uint32_t headSeen;
+};
+
+#endif
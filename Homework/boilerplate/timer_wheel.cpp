@@ -0,0 +1,123 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+TimerWheel::TimerWheel(uint64_t now) : armedCount(0), current(now) {
+  // handle 0 is NONE and is never armed
+  Node none = {0, NULL, NULL, NONE, NONE, -1};
+  nodes.push_back(none);
+  memset(heads, 0, sizeof(heads));
+  memset(occupied, 0, sizeof(occupied));
+}
+
+uint32_t TimerWheel::create(Callback callback, void *arg) {
+  uint32_t timer;
+  if (!freeNodes.empty()) {
+    timer = freeNodes.back();
+    freeNodes.pop_back();
+  } else {
+    timer = nodes.size();
+    nodes.resize(timer + 1);
+  }
+  Node n = {0, callback, arg, NONE, NONE, -1};
+  nodes[timer] = n;
+  return timer;
+}
+
+void TimerWheel::destroy(uint32_t timer) {
+  if (timer == NONE) return;
+  cancel(timer);
+  freeNodes.push_back(timer);
+}
+
+void TimerWheel::arm(uint32_t timer, uint64_t deadline) {
+  if (armed(timer)) unlink(timer);
+  nodes[timer].deadline = deadline;
+  // the slot of the current tick has been fired already
+  link(timer, current + 1);
+}
+
+void TimerWheel::cancel(uint32_t timer) {
+  if (armed(timer)) unlink(timer);
+}
+
+void TimerWheel::link(uint32_t timer, uint64_t earliest) {
+  Node &n = nodes[timer];
+  uint64_t at = n.deadline > earliest ? n.deadline : earliest;
+  uint64_t delta = at - current;
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= 1ULL << (BITS * (level + 1))) level++;
+  // beyond the top level: park in its furthest slot, placed again from there
+  if (delta >= 1ULL << (BITS * LEVELS)) at = current + (1ULL << (BITS * LEVELS)) - 1;
+  int index = (at >> (BITS * level)) & (SLOTS - 1);
+
+  n.slot = level * SLOTS + index;
+  n.prev = NONE;
+  n.next = heads[n.slot];
+  if (n.next != NONE) nodes[n.next].prev = timer;
+  heads[n.slot] = timer;
+  occupied[level] |= 1ULL << index;
+  armedCount++;
+}
+
+void TimerWheel::unlink(uint32_t timer) {
+  Node &n = nodes[timer];
+  if (n.prev != NONE) nodes[n.prev].next = n.next;
+  else heads[n.slot] = n.next;
+  if (n.next != NONE) nodes[n.next].prev = n.prev;
+  if (heads[n.slot] == NONE) occupied[n.slot / SLOTS] &= ~(1ULL << (n.slot % SLOTS));
+  n.slot = -1;
+  armedCount--;
+}
+
+uint64_t TimerWheel::nextEvent() const {
+  uint64_t best = UINT64_MAX;
+  for (int level = 0; level < LEVELS; level++) {
+    if (!occupied[level]) continue;
+    // the slots of a level come up in turn, starting after the current one
+    uint64_t block = (current >> (BITS * level)) + 1;
+    int from = block & (SLOTS - 1);
+    uint64_t bits = occupied[level];
+    uint64_t rotated = from ? (bits >> from) | (bits << (SLOTS - from)) : bits;
+    uint64_t at = (block + __builtin_ctzll(rotated)) << (BITS * level);
+    if (at < best) best = at;
+  }
+  return best;
+}
+
+void TimerWheel::advance(uint64_t now) {
+  // empty stretches are skipped, only ticks with work are visited
+  while (armedCount > 0) {
+    uint64_t at = nextEvent();
+    if (at > now) break;
+    current = at;
+    // slots that have come up move down a level or more, highest first
+    for (int level = LEVELS - 1; level > 0; level--) {
+      if (current & ((1ULL << (BITS * level)) - 1)) continue;
+      int slot = level * SLOTS + ((current >> (BITS * level)) & (SLOTS - 1));
+      while (heads[slot] != NONE) {
+        uint32_t timer = heads[slot];
+        unlink(timer);
+        // those due now go into the slot fired below
+        link(timer, current);
+      }
+    }
+    int slot = current & (SLOTS - 1);
+    while (heads[slot] != NONE) {
+      uint32_t timer = heads[slot];
+      unlink(timer);
+      if (nodes[timer].deadline > current) {
+        // parked in the top level, not due yet
+        link(timer, current + 1);
+        continue;
+      }
+      nodes[timer].callback(timer, nodes[timer].arg);
+    }
+  }
+  if (current < now) current = now;
+}
+
+int64_t TimerWheel::timeout(uint64_t now) const {
+  if (armedCount == 0) return -1;
+  uint64_t at = nextEvent();
+  return at > now ? at - now : 0;
+}
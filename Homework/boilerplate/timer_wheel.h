@@ -0,0 +1,72 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <stdint.h>
+#include <vector>
+
+// Hierarchical timing wheel with millisecond ticks.
+//
+// Level 0 has one slot per tick for the next 64 ms, and each level above has
+// slots 64 times as wide. A timer sits in the slot of the level its deadline
+// falls into and moves one level down when the wheel reaches that slot, so
+// arm and cancel are O(1) and a timer is moved at most LEVELS - 1 times.
+// Deadlines further away than the top level wait in its last slot. Timers
+// are referred to by handles; the wheel is not thread safe.
+class TimerWheel {
+public:
+  typedef void (*Callback)(uint32_t timer, void *arg);
+  static const uint32_t NONE = 0;
+
+  explicit TimerWheel(uint64_t now = 0);
+
+  // returns an unarmed timer that calls back with arg when it fires
+  uint32_t create(Callback callback, void *arg);
+  void destroy(uint32_t timer);
+
+  // (re)schedules the timer, a deadline already passed fires on the next tick
+  void arm(uint32_t timer, uint64_t deadline);
+  void cancel(uint32_t timer);
+  bool armed(uint32_t timer) const { return nodes[timer].slot >= 0; }
+
+  // fires every timer due by now, in order of their slots; callbacks may arm
+  // and cancel any timer, including their own
+  void advance(uint64_t now);
+  // the time the wheel has advanced to
+  uint64_t now() const { return current; }
+  // milliseconds until the wheel next has work to do, -1 if nothing is armed;
+  // may be earlier than the next deadline when a slot has to move down
+  int64_t timeout(uint64_t now) const;
+
+private:
+  static const int BITS = 6;
+  static const int SLOTS = 1 << BITS;
+  static const int LEVELS = 4;
+
+  struct Node {
+    uint64_t deadline;
+    Callback callback;
+    void *arg;
+    // neighbours in the slot list, NONE at the ends
+    uint32_t prev;
+    uint32_t next;
+    // index into heads, -1 while not armed
+    int32_t slot;
+  };
+
+  // puts the timer into the slot of its deadline, or of earliest if that is
+  // later
+  void link(uint32_t timer, uint64_t earliest);
+  void unlink(uint32_t timer);
+  // tick at which the wheel next has a slot to fire or to move down
+  uint64_t nextEvent() const;
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> freeNodes;
+  uint32_t heads[LEVELS * SLOTS];
+  // non-empty slots of each level
+  uint64_t occupied[LEVELS];
+  uint32_t armedCount;
+  uint64_t current;
+};
+
+#endif
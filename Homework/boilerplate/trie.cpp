@@ -0,0 +1,115 @@
+#include "trie.h"
+#include <string.h>
+
+MultibitTrie::MultibitTrie() : defaultAdj(0) {
+  // node 0 is the root and is never freed
+  allocNode();
+}
+
+int MultibitTrie::allocNode() {
+  int node;
+  if (!freeNodes.empty()) {
+    node = freeNodes.back();
+    freeNodes.pop_back();
+  } else {
+    node = nodes.size();
+    nodes.resize(node + 1);
+  }
+  Node &n = nodes[node];
+  memset(&n, 0, sizeof(Node));
+  for (int i = 0; i < FANOUT; i++) {
+    n.slots[i].child = -1;
+  }
+  return node;
+}
+
+void MultibitTrie::freeNode(int node) { freeNodes.push_back(node); }
+
+bool MultibitTrie::insert(uint32_t key, uint32_t len, uint16_t adj) {
+  key &= prefixMask(len);
+  prefixes[prefixKey(key, len)] = adj;
+  if (len == 0) {
+    defaultAdj = adj;
+    return true;
+  }
+
+  int level = (len - 1) / STRIDE;
+  int node = 0;
+  for (int l = 0; l < level; l++) {
+    uint32_t idx = chunk(key, l);
+    int child = nodes[node].slots[idx].child;
+    if (child < 0) {
+      // allocNode may reallocate nodes, so do not hold references across it
+      child = allocNode();
+      nodes[node].slots[idx].child = child;
+      nodes[node].refs++;
+    }
+    node = child;
+  }
+
+  // expand over every slot the prefix covers, unless a longer one owns it
+  Node &n = nodes[node];
+  uint32_t first = chunk(key, level);
+  uint32_t count = 1u << ((level + 1) * STRIDE - len);
+  for (uint32_t i = first; i < first + count; i++) {
+    Slot &s = n.slots[i];
+    if (s.len > len) continue;
+    if (s.len == 0) n.refs++;
+    s.len = len;
+    s.adj = adj;
+  }
+  return true;
+}
+
+bool MultibitTrie::remove(uint32_t key, uint32_t len) {
+  key &= prefixMask(len);
+  auto it = prefixes.find(prefixKey(key, len));
+  if (it == prefixes.end()) return false;
+  prefixes.erase(it);
+  if (len == 0) {
+    defaultAdj = 0;
+    return true;
+  }
+
+  int level = (len - 1) / STRIDE;
+  int path[LEVELS];
+  path[0] = 0;
+  for (int l = 0; l < level; l++) {
+    int child = nodes[path[l]].slots[chunk(key, l)].child;
+    if (child < 0) return true;
+    path[l + 1] = child;
+  }
+
+  // the slots fall back to the longest shorter prefix stored in this node;
+  // anything shorter than that is found in an ancestor during lookup
+  uint32_t coverLen = 0;
+  uint16_t cover = 0;
+  for (uint32_t l = len - 1; l > (uint32_t)level * STRIDE; l--) {
+    auto c = prefixes.find(prefixKey(key & prefixMask(l), l));
+    if (c != prefixes.end()) {
+      coverLen = l;
+      cover = c->second;
+      break;
+    }
+  }
+
+  Node &n = nodes[path[level]];
+  uint32_t first = chunk(key, level);
+  uint32_t count = 1u << ((level + 1) * STRIDE - len);
+  for (uint32_t i = first; i < first + count; i++) {
+    Slot &s = n.slots[i];
+    if (s.len != len) continue;
+    s.len = coverLen;
+    s.adj = cover;
+    if (coverLen == 0) n.refs--;
+  }
+
+  // release nodes that became empty
+  for (int l = level; l > 0 && nodes[path[l]].refs == 0; l--) {
+    Slot &s = nodes[path[l - 1]].slots[chunk(key, l - 1)];
+    s.child = -1;
+    nodes[path[l - 1]].refs--;
+    freeNode(path[l]);
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+#ifndef __TRIE_H__
+#define __TRIE_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+// Fixed-stride multibit trie with controlled prefix expansion.
+//
+// Keys are IPv4 addresses in host byte order, values are adjacency indices
+// and 0 means no route. A prefix of length len lives in
+// the node at level (len - 1) / STRIDE and is expanded over the slots it
+// covers there, so a lookup reads at most LEVELS slots and an update touches
+// at most one node's worth of slots plus STRIDE exact-match probes.
+class MultibitTrie {
+public:
+  static const int STRIDE = 8;
+  static const int LEVELS = 32 / STRIDE;
+  static const int FANOUT = 1 << STRIDE;
+
+  MultibitTrie();
+
+  // insert or replace the route for key/len
+  bool insert(uint32_t key, uint32_t len, uint16_t adj);
+  // remove the route for key/len, returns false if it does not exist
+  bool remove(uint32_t key, uint32_t len);
+  // exact match, returns the adjacency installed for key/len or 0
+  uint16_t find(uint32_t key, uint32_t len) const {
+    auto it = prefixes.find(prefixKey(key & prefixMask(len), len));
+    return it == prefixes.end() ? 0 : it->second;
+  }
+  // longest prefix match
+  uint16_t lookup(uint32_t key) const {
+    uint16_t best = defaultAdj;
+    int node = 0;
+    for (int level = 0; level < LEVELS; level++) {
+      const Slot &s = nodes[node].slots[chunk(key, level)];
+      if (s.len) best = s.adj;
+      if (s.child < 0) break;
+      node = s.child;
+    }
+    return best;
+  }
+
+  size_t size() const { return prefixes.size(); }
+  // bytes held by the nodes, the exact-match index not counted
+  size_t memory() const { return nodes.capacity() * sizeof(Node); }
+
+private:
+  struct Slot {
+    uint16_t adj;
+    // length of the prefix expanded into this slot, 0 if empty
+    uint8_t len;
+    int32_t child;
+  };
+
+  struct Node {
+    Slot slots[FANOUT];
+    // number of slots holding a route or a child
+    int refs;
+  };
+
+  static uint32_t chunk(uint32_t key, int level) {
+    return (key >> (32 - STRIDE * (level + 1))) & (FANOUT - 1);
+  }
+  static uint32_t prefixMask(uint32_t len) {
+    return len ? ~0u << (32 - len) : 0;
+  }
+  static uint64_t prefixKey(uint32_t key, uint32_t len) {
+    return ((uint64_t)key << 8) | len;
+  }
+
+  int allocNode();
+  void freeNode(int node);
+
+  std::vector<Node> nodes;
+  std::vector<int> freeNodes;
+  // exact-match view of every installed prefix, used to find the covering
+  // route when a more specific one is withdrawn
+  std::unordered_map<uint64_t, uint16_t> prefixes;
+  uint16_t defaultAdj;
+};
+
+#endif
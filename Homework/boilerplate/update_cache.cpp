@@ -0,0 +1,82 @@
+#include "update_cache.h"
+#include "checksum.h"
+#include <arpa/inet.h>
+#include <string.h>
+
+// IPv4, UDP and RIP headers of a response sent to 224.0.0.9 from addr
+static void writeHeader(uint8_t *packet, in_addr_t addr, size_t length) {
+  static const uint8_t header[UpdateCache::HEADER_SIZE] = {
+      0x45, 0xc0, 0, 0, 0, 0, 0, 0, 1, 17, 0, 0, 0, 0, 0, 0, 224, 0, 0, 9,
+      0x02, 0x08, 0x02, 0x08, 0, 0, 0, 0,
+      2, 2, 0, 0};
+  memcpy(packet, header, sizeof(header));
+  packet[2] = length >> 8;
+  packet[3] = length & 0xff;
+  memcpy(&packet[12], &addr, sizeof(in_addr_t));
+  packet[24] = (length - 20) >> 8;
+  packet[25] = (length - 20) & 0xff;
+  uint16_t checksum = internetChecksum(packet, 20);
+  packet[10] = checksum >> 8;
+  packet[11] = checksum & 0xff;
+  checksum = udpChecksum(packet, length);
+  packet[26] = checksum >> 8;
+  packet[27] = checksum & 0xff;
+}
+
+UpdateCache::UpdateCache() : count(0) {
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) trains[i].addr = 0;
+}
+
+void UpdateCache::setAddresses(const in_addr_t addrs[N_IFACE_ON_BOARD]) {
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    trains[i].addr = addrs[i];
+    trains[i].stale.assign(trains[i].stale.size(), true);
+  }
+}
+
+void UpdateCache::set(uint32_t index, const RoutingTableEntry &route) {
+  if (index >= count) resize(index + 1);
+  uint32_t k = index / 25;
+  size_t offset = k * PACKET_SIZE + HEADER_SIZE + (index % 25) * ENTRY_SIZE;
+  uint32_t mask = htonl(route.len ? ~0u << (32 - route.len) : 0);
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    uint8_t *entry = &trains[i].buffer[offset];
+    // address family 2, route tag 0
+    entry[0] = 0;
+    entry[1] = 2;
+    entry[2] = 0;
+    entry[3] = 0;
+    memcpy(&entry[4], &route.addr, 4);
+    memcpy(&entry[8], &mask, 4);
+    memcpy(&entry[12], &route.nexthop, 4);
+    uint32_t metric = htonl(route.if_index == (uint32_t)i ? 16 : route.metric);
+    memcpy(&entry[16], &metric, 4);
+    trains[i].stale[k] = true;
+  }
+}
+
+void UpdateCache::resize(uint32_t size) {
+  uint32_t before = packetCount();
+  count = size;
+  uint32_t after = packetCount();
+  // the last packet before and after may have a new length
+  uint32_t first = before < after ? before : after;
+  if (first > 0) first--;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    trains[i].buffer.resize(after * PACKET_SIZE);
+    trains[i].stale.resize(after);
+    for (uint32_t k = first; k < after; k++) trains[i].stale[k] = true;
+  }
+}
+
+const uint8_t *UpdateCache::packet(int if_index, uint32_t k, size_t *length) {
+  Train &train = trains[if_index];
+  uint32_t entries = k + 1 < packetCount() ? 25 : count - k * 25;
+  *length = HEADER_SIZE + entries * ENTRY_SIZE;
+  uint8_t *packet = &train.buffer[k * PACKET_SIZE];
+  if (train.stale[k]) {
+    writeHeader(packet, train.addr, *length);
+    train.stale[k] = false;
+  }
+  return packet;
+}
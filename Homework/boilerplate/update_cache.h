@@ -0,0 +1,50 @@
+#ifndef __UPDATE_CACHE_H__
+#define __UPDATE_CACHE_H__
+
+#include "router.h"
+#include "router_hal.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+// The periodic RIP update of every interface as ready IPv4 packets.
+//
+// Route i of the routing table is entry i % 25 of packet i / 25 on every
+// interface, so a change to one route rewrites 20 bytes per interface. On
+// the interface a route was learned from it is advertised with metric 16
+// (split horizon with poisoned reverse). Checksums of the packets touched
+// are brought up to date when they are next read.
+class UpdateCache {
+public:
+  static const size_t HEADER_SIZE = 20 + 8 + 4;
+  static const size_t ENTRY_SIZE = 20;
+  static const size_t PACKET_SIZE = HEADER_SIZE + 25 * ENTRY_SIZE;
+
+  UpdateCache();
+
+  // source addresses of the packets, one per interface
+  void setAddresses(const in_addr_t addrs[N_IFACE_ON_BOARD]);
+  // route index of the routing table is now route, index may be one past the end
+  void set(uint32_t index, const RoutingTableEntry &route);
+  // the routing table now has count routes
+  void resize(uint32_t count);
+
+  // packets in an update, the same on every interface
+  uint32_t packetCount() const { return (count + 24) / 25; }
+  // packet k of the update on if_index, its length goes into *length
+  const uint8_t *packet(int if_index, uint32_t k, size_t *length);
+
+private:
+  struct Train {
+    // packets back to back, PACKET_SIZE bytes apart
+    std::vector<uint8_t> buffer;
+    // packets whose length or checksums are out of date
+    std::vector<bool> stale;
+    in_addr_t addr;
+  };
+
+  Train trains[N_IFACE_ON_BOARD];
+  uint32_t count;
+};
+
+#endif